@@ -26,10 +26,37 @@
 
 #include <boost/math/special_functions/beta.hpp>
 
+#include <cmath>
+
 #include "binom.hpp"
+#include "utils.hpp"
 
 namespace bm = boost::math;
 
+// --------------------------------------------------------------------
+// log(n!) for the small values of n used in practice, computed the same
+// way as before so the results do not change
+
+const int kLogFactorialTableSize = 1 << 15;
+
+struct log_factorial_table
+{
+	log_factorial_table()
+	{
+		for (int i = 0; i < kLogFactorialTableSize; ++i)
+			m_table[i] = std::lgamma(i + 1);
+	}
+
+	double operator()(int n) const
+	{
+		return n < kLogFactorialTableSize ? m_table[n] : std::lgamma(n + 1);
+	}
+
+	double m_table[kLogFactorialTableSize];
+};
+
+const log_factorial_table kLogFactorial;
+
 inline double xlogy(double x, double y)
 {
 	return (x == 0 and not std::isnan(y)) 
@@ -46,10 +73,9 @@ inline double xlog1py(double x, double y)
 
 double binom_pmf(int x, int n, double p)
 {
-	double combiln = std::lgamma(n + 1) - (std::lgamma(x + 1) + std::lgamma(n - x + 1));
+	double combiln = kLogFactorial(n) - (kLogFactorial(x) + kLogFactorial(n - x));
 	return std::exp(combiln + xlogy(x, p) + xlog1py(n - x, -p));
 }
-
 double binom_cdf(double x, double n, double p)
 {
 	double result;
@@ -83,11 +109,89 @@ double binom_sf(double x, double n, double p)
 	return result;
 }
 
+// --------------------------------------------------------------------
+// The pmf is unimodal, on the side of the mean opposite to x it is
+// monotone. So the values with a density not exceeding that of x form
+// a single run at the far end, its length is found using bisection.
+
+double binom_test_uncached(int x, int n, double p)
+{
+	double d = binom_pmf(x, n, p);
+	double rerr = 1 + 1e-7;
+	double d_rerr = d * rerr;
+
+	double pval = 1;
+
+	if (x < p * n)
+	{
+		// densities are decreasing on [ceil(pn), n], find the first i
+		// with binom_pmf(i) <= d_rerr
+		int a = static_cast<int>(std::ceil(p * n)), b = n + 1;
+
+		while (a < b)
+		{
+			int m = a + (b - a) / 2;
+			if (binom_pmf(m, n, p) <= d_rerr)
+				b = m;
+			else
+				a = m + 1;
+		}
+
+		int y = n + 1 - a;
+
+		pval = binom_cdf(x, n, p) + binom_sf(n - y, n, p);
+	}
+	else if (x > p * n)
+	{
+		// densities are increasing on [0, floor(pn)], find the first i
+		// with binom_pmf(i) > d_rerr
+		int a = 0, b = static_cast<int>(std::floor(p * n)) + 1;
+
+		while (a < b)
+		{
+			int m = a + (b - a) / 2;
+			if (binom_pmf(m, n, p) <= d_rerr)
+				a = m + 1;
+			else
+				b = m;
+		}
+
+		int y = a;
+
+		pval = binom_cdf(y - 1, n, p) + binom_sf(x - 1, n, p);
+	}
+
+	return pval;
+}
+
+// --------------------------------------------------------------------
+// Tests with p = 0.5 are memoised, the same (x, n) pairs recur for
+// many genes and replicates.
+
 double binom_test(int x, int n, double p)
 {
 	if (p < 0 or p > 1)
 		throw std::invalid_argument("p should be in the range 0 <= p <= 1");
 
+	if (p != 0.5)
+		return binom_test_uncached(x, n, p);
+
+	static sharded_memo<uint64_t, double> s_cache;
+
+	uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(n)) << 32) | static_cast<uint32_t>(x);
+	return s_cache(key, [x, n]() { return binom_test_uncached(x, n, 0.5); });
+}
+
+#if defined(BINOM_MAIN)
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// The previous implementation, evaluating every density on the opposite side
+double binom_test_reference(int x, int n, double p)
+{
 	double d = binom_pmf(x, n, p);
 	double rerr = 1 + 1e-7;
 	double d_rerr = d * rerr;
@@ -122,4 +226,61 @@ double binom_test(int x, int n, double p)
 	}
 
 	return pval;
-}
\ No newline at end of file
+}
+
+int main()
+{
+	// The number of normalised insertions per gene in an SL replicate is
+	// roughly log-normal, most genes have a few dozen and some thousands.
+	std::mt19937 rng(1);
+	std::lognormal_distribution<double> nd(3.5, 1.2);
+
+	std::vector<std::pair<int, int>> tests;
+	for (int i = 0; i < 200000; ++i)
+	{
+		int n = std::min(static_cast<int>(nd(rng)), 20000);
+		std::binomial_distribution<int> xd(n, (i % 10) == 0 ? 0.2 : 0.5);
+		tests.emplace_back(xd(rng), n);
+	}
+
+	using namespace std::chrono;
+
+	auto t0 = steady_clock::now();
+
+	double s1 = 0;
+	for (auto [x, n] : tests)
+		s1 += binom_test_reference(x, n, 0.5);
+
+	auto t1 = steady_clock::now();
+
+	double s2 = 0;
+	for (auto [x, n] : tests)
+		s2 += binom_test_uncached(x, n, 0.5);
+
+	auto t2 = steady_clock::now();
+
+	double s3 = 0;
+	for (auto [x, n] : tests)
+		s3 += binom_test(x, n, 0.5);
+
+	auto t3 = steady_clock::now();
+
+	size_t mismatches = 0;
+	for (auto [x, n] : tests)
+	{
+		for (double p : { 0.5, 0.3 })
+		{
+			if (binom_test_reference(x, n, p) != binom_test(x, n, p))
+				++mismatches;
+		}
+	}
+
+	std::cout << "reference    " << duration<double>(t1 - t0).count() << "s" << std::endl
+			  << "bisection    " << duration<double>(t2 - t1).count() << "s" << std::endl
+			  << "memoised     " << duration<double>(t3 - t2).count() << "s" << std::endl
+			  << "mismatches   " << mismatches << " (checksums " << s1 << " " << s2 << " " << s3 << ")" << std::endl;
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+#endif
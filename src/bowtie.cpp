@@ -60,6 +60,33 @@ extern int VERBOSE;
 
 // --------------------------------------------------------------------
 
+InsertionIndex::InsertionIndex(const std::vector<Insertion> &insertions)
+{
+	// count per slot first, then place the positions. Input is sorted on
+	// chromosome and position so each slot ends up sorted as well.
+#if DEBUG
+	assert(std::adjacent_find(insertions.begin(), insertions.end(), [](auto &a, auto &b) { return not (a < b); }) == insertions.end());
+#endif
+
+	std::array<uint32_t, kSlots + 1> next = {};
+
+	for (auto &ins : insertions)
+		++next[slot(ins.chr, ins.strand) + 1];
+
+	for (size_t i = 1; i <= kSlots; ++i)
+		next[i] += next[i - 1];
+
+	m_offset = next;
+	m_pos.resize(insertions.size());
+
+	for (auto &ins : insertions)
+		m_pos[next[slot(ins.chr, ins.strand)]++] = ins.pos;
+
+	assert(next[kSlots - 1] == insertions.size());
+}
+
+// --------------------------------------------------------------------
+
 double system_time()
 {
 	struct timeval tv;
@@ -172,7 +199,7 @@ struct progress_filter
 
 std::vector<Insertion> runBowtieInt(const std::filesystem::path& bowtie,
 	const std::filesystem::path& bowtieIndex, const std::filesystem::path& fastq,
-	const std::filesystem::path& logFile, unsigned threads, unsigned trimLength,
+	const std::filesystem::path& logFile, unsigned threads, unsigned trimLength, int niceness,
 	int maxmismatch = 0, std::filesystem::path mismatchfile = {})
 {
 	auto p = std::to_string(threads);
@@ -232,6 +259,9 @@ std::vector<Insertion> runBowtieInt(const std::filesystem::path& bowtie,
 
 		closefrom(STDERR_FILENO + 1);
 
+		if (niceness > 0)
+			(void)nice(niceness);
+
 		const char* env[] = { nullptr };
 		(void)execve(args.front(), const_cast<char* const*>(&args[0]), const_cast<char* const*>(env));
 		exit(-1);
@@ -434,17 +464,17 @@ std::vector<Insertion> runBowtieInt(const std::filesystem::path& bowtie,
 
 std::vector<Insertion> runBowtie(const std::filesystem::path& bowtie,
 	const std::filesystem::path& bowtieIndex, const std::filesystem::path& fastq,
-	const std::filesystem::path& logFile, unsigned threads, unsigned trimLength)
+	const std::filesystem::path& logFile, unsigned threads, unsigned trimLength, int niceness)
 {
 	fs::path m = fs::temp_directory_path() / ("mismatched-" + std::to_string(getpid()) + ".fastq");
 
-	auto result = runBowtieInt(bowtie, bowtieIndex, fastq, logFile, threads, trimLength, 1, m);
+	auto result = runBowtieInt(bowtie, bowtieIndex, fastq, logFile, threads, trimLength, niceness, 1, m);
 
 	if (fs::exists(m))
 	{
 		if (fs::file_size(m) > 0)
 		{
-			auto ins_2 = runBowtieInt(bowtie, bowtieIndex, m, logFile, threads, trimLength);
+			auto ins_2 = runBowtieInt(bowtie, bowtieIndex, m, logFile, threads, trimLength, niceness);
 
 			std::vector<Insertion> merged;
 			merged.reserve(result.size() + ins_2.size());
@@ -31,15 +31,24 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <filesystem>
 #include <map>
 #include <set>
 
 #include "refseq.hpp"
 
+// The distinct insertion positions hitting a transcript, sorted
 struct Insertions
 {
-	std::set<long> sense, antiSense;
+	std::vector<uint32_t> sense, antiSense;
+};
+
+// Count-only variant of the above, sufficient for the analysis
+struct InsertionTally
+{
+	uint32_t sense = 0, antiSense = 0;
 };
 
 // --------------------------------------------------------------------
@@ -80,6 +89,49 @@ struct Insertion
 
 static_assert(sizeof(Insertion) == 8);
 
+// --------------------------------------------------------------------
+// The positions of a list of insertions, split per chromosome and strand
+// and sorted. Since the position of an entry is also the number of
+// entries before it, counting the insertions in any range is a matter
+// of two binary searches.
+
+class InsertionIndex
+{
+  public:
+	InsertionIndex() = default;
+
+	// \a insertions should be sorted, as returned by read_insertions
+	explicit InsertionIndex(const std::vector<Insertion> &insertions);
+
+	// the number of insertions on chr and strand in [start, end)
+	uint32_t count(CHROM chr, char strand, uint32_t start, uint32_t end) const
+	{
+		auto b = m_pos.begin() + m_offset[slot(chr, strand)];
+		auto e = m_pos.begin() + m_offset[slot(chr, strand) + 1];
+
+		auto lb = std::lower_bound(b, e, start);
+		return std::lower_bound(lb, e, end) - lb;
+	}
+
+	size_t size() const { return m_pos.size(); }
+
+	size_t memory_usage() const
+	{
+		return sizeof(*this) + m_pos.capacity() * sizeof(uint32_t);
+	}
+
+  private:
+	static constexpr size_t kSlots = 2 * (CHROM::CHR_Y + 1);
+
+	static size_t slot(CHROM chr, char strand)
+	{
+		return 2 * chr + (strand == '+' ? 0 : 1);
+	}
+
+	std::array<uint32_t, kSlots + 1> m_offset = {};
+	std::vector<uint32_t> m_pos;
+};
+
 // --------------------------------------------------------------------
 
 class bowtie_parameters
@@ -93,9 +145,10 @@ class bowtie_parameters
 	}
 
 	static void init(std::filesystem::path bowtie, unsigned threads, unsigned trimLength,
-		const std::string &assembly, const std::map<std::string, std::filesystem::path> &assemblyIndices)
+		const std::string &assembly, const std::map<std::string, std::filesystem::path> &assemblyIndices,
+		int niceness = 0)
 	{
-		s_instance.reset(new bowtie_parameters(bowtie, threads, trimLength, assembly, assemblyIndices));
+		s_instance.reset(new bowtie_parameters(bowtie, threads, trimLength, assembly, assemblyIndices, niceness));
 	}
 
 	std::filesystem::path bowtie() const { return m_bowtie; }
@@ -106,17 +159,22 @@ class bowtie_parameters
 	unsigned threads() const { return m_threads; }
 	unsigned trimLength() const { return m_trimLength; }
 
+	/// \brief The nice increment for bowtie processes, so mapping does not slow down the server.
+	int niceness() const { return m_niceness; }
+
 	/// \brief The default assembly to use.
 	const std::string &assembly() const { return m_assembly; }
 
   private:
 	bowtie_parameters(std::filesystem::path bowtie, unsigned threads, unsigned trimLength,
-		const std::string &assembly, const std::map<std::string, std::filesystem::path> &assemblyIndices)
+		const std::string &assembly, const std::map<std::string, std::filesystem::path> &assemblyIndices,
+		int niceness)
 		: m_bowtie(bowtie)
 		, m_threads(threads)
 		, m_trimLength(trimLength)
 		, m_assembly(assembly)
 		, m_assemblyIndices(assemblyIndices)
+		, m_niceness(niceness)
 	{
 	}
 
@@ -127,6 +185,7 @@ class bowtie_parameters
 	unsigned m_trimLength;
 	std::string m_assembly;
 	std::map<std::string, std::filesystem::path> m_assemblyIndices;
+	int m_niceness;
 };
 
 // --------------------------------------------------------------------
@@ -137,7 +196,7 @@ std::string bowtieVersion(std::filesystem::path bowtie);
 /// \brief First version of runBowtie, with all the possible parameters
 std::vector<Insertion> runBowtie(const std::filesystem::path &bowtie,
 	const std::filesystem::path &bowtieIndex, const std::filesystem::path &fastq,
-	const std::filesystem::path &logFile, unsigned threads, unsigned trimLength);
+	const std::filesystem::path &logFile, unsigned threads, unsigned trimLength, int niceness = 0);
 
 // /// \brief Alternative for runBowtie, using predefined parameters
 // std::vector<Insertion> runBowtie(const std::string& assembly, std::filesystem::path fastq);
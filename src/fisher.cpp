@@ -175,7 +175,7 @@ double binomial_coefficient(long x, long n, double p)
 			auto lc = stirling_error(n) - stirling_error(x) - stirling_error(n - x) - bd0(x, n * p) - bd0(n - x, n * q);
 
 			// auto lf = kLn2PI + log(x) + log(n-x) - log(n);
-			auto lf = kLn2PI + std::log(x) + std::log1p(-x / n);
+			auto lf = kLn2PI + std::log(x) + std::log1p(-static_cast<double>(x) / n);
 
 			result = lc - 0.5 * lf;
 		}
@@ -343,9 +343,130 @@ double fisherTest2x2(long v[2][2], FisherAlternative alternative)
 	}
 }
 
+// --------------------------------------------------------------------
+// The distribution of v[0][0] is hypergeometric, only the relative
+// densities are needed since they are normalised anyway. Those are
+// calculated with the ratio of successive densities starting at the
+// mode, which is both cheaper and, for the large column totals in a
+// screen, more precise than taking differences of log factorials.
+
+FisherEngine::FisherEngine(long column0, long column1)
+	: m_k(column0)
+	, m_N(column0 + column1)
+{
+}
+
+double FisherEngine::operator()(long v[2][2], FisherAlternative alternative) const
+{
+	assert(v[0][0] + v[1][0] == m_k);
+	assert(v[0][0] + v[0][1] + v[1][0] + v[1][1] == m_N);
+
+	const long m = v[0][0] + v[0][1];
+	const long n = m_N - m;
+	const long k = m_k;
+	const long x = v[0][0];
+
+	const long lo = std::max(0L, k - n);
+	const long hi = std::min(k, m);
+
+	long mode = static_cast<long>((static_cast<double>(m + 1) * (k + 1)) / (m_N + 2));
+	mode = std::clamp(mode, lo, hi);
+
+	// call f(i, d) for each i in the support, d relative to d(mode) = 1
+	auto visit = [=](auto &&f)
+	{
+		double d = 1;
+		f(mode, d);
+
+		for (long i = mode; i < hi; ++i)
+		{
+			d *= (static_cast<double>(m - i) * (k - i)) / (static_cast<double>(i + 1) * (n - k + i + 1));
+			if (d == 0)
+				break;
+			f(i + 1, d);
+		}
+
+		d = 1;
+		for (long i = mode; i > lo; --i)
+		{
+			d *= (static_cast<double>(i) * (n - k + i)) / (static_cast<double>(m - i + 1) * (k - i + 1));
+			if (d == 0)
+				break;
+			f(i - 1, d);
+		}
+	};
+
+	double sum = 0, dx = 0, tail = 0;
+
+	visit([&](long i, double d)
+	{
+		sum += d;
+		if (i == x)
+			dx = d;
+		if ((alternative == FisherAlternative::Left and i <= x) or (alternative == FisherAlternative::Right and i >= x))
+			tail += d;
+	});
+
+	if (alternative == FisherAlternative::TwoSided)
+	{
+		const double kRelErr = 1 + 1e-7;
+		const double max = dx * kRelErr;
+
+		visit([&](long, double d)
+		{
+			if (d <= max)
+				tail += d;
+		});
+	}
+
+	return tail / sum;
+}
+
+// --------------------------------------------------------------------
+
+FisherCache &FisherCache::instance()
+{
+	static FisherCache s_instance;
+	return s_instance;
+}
+
+size_t FisherCache::key_hash::operator()(const key &k) const
+{
+	size_t h = static_cast<size_t>(k.alternative);
+	for (auto v : k.v)
+		h = (h ^ static_cast<size_t>(v)) * 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+double FisherCache::operator()(long v[2][2], FisherAlternative alternative)
+{
+	return m_memo({ { v[0][0], v[0][1], v[1][0], v[1][1] }, alternative }, [v, alternative]()
+		{
+			FisherEngine engine(v[0][0] + v[1][0], v[0][1] + v[1][1]);
+			return engine(v, alternative);
+		});
+}
+
+double FisherCache::operator()(const FisherEngine &engine, long v[2][2], FisherAlternative alternative)
+{
+	return m_memo({ { v[0][0], v[0][1], v[1][0], v[1][1] }, alternative }, [&engine, v, alternative]()
+		{ return engine(v, alternative); });
+}
+
 // --------------------------------------------------------------------
 
 FishersExactTest::FishersExactTest(long v[2][2], FisherAlternative alternative)
+{
+	std::vector<double> scratch;
+	calculate(v, alternative, scratch);
+}
+
+FishersExactTest::FishersExactTest(long v[2][2], FisherAlternative alternative, std::vector<double> &scratch)
+{
+	calculate(v, alternative, scratch);
+}
+
+void FishersExactTest::calculate(long v[2][2], FisherAlternative alternative, std::vector<double> &logdc)
 {
 	auto m = v[0][0] + v[0][1];
 	auto n = v[1][0] + v[1][1];
@@ -358,54 +479,67 @@ FishersExactTest::FishersExactTest(long v[2][2], FisherAlternative alternative)
 	if (hi > m)
 		hi = m;
 
-	std::vector<double> logdc(hi - lo + 1);
-	for (auto i = lo; i <= hi; ++i)
-		logdc[i - lo] = hypergeometric_probability(i, m, n, k);
+	// Log densities relative to the mode, only relative values are needed
+	// since everything is normalised. Successive densities differ by a
+	// simple ratio, much cheaper than evaluating each density separately.
+	logdc.resize(hi - lo + 1);
 
-	auto dnhyper = [lo, hi, logdc](double ncp)
-	{
-		std::vector<double> d(logdc);
-
-		for (long i = lo; i <= hi; ++i)
-			d[i - lo] += std::log(ncp) * i;
-		
-		auto dmax = *std::max_element(d.begin(), d.end());
-
-		for (auto &di : d)
-			di = std::exp(di - dmax);
-		
-		auto dsum = std::accumulate(d.begin(), d.end(), 0.0);
+	long mode = static_cast<long>((static_cast<double>(m + 1) * (k + 1)) / (m + n + 2));
+	mode = std::clamp(mode, lo, hi);
 
-		for (auto &di : d)
-			di /= dsum;
+	logdc[mode - lo] = 0;
+	for (auto i = mode; i < hi; ++i)
+		logdc[i + 1 - lo] = logdc[i - lo] + std::log((static_cast<double>(m - i) * (k - i)) / (static_cast<double>(i + 1) * (n - k + i + 1)));
+	for (auto i = mode; i > lo; --i)
+		logdc[i - 1 - lo] = logdc[i - lo] + std::log((static_cast<double>(i) * (n - k + i)) / (static_cast<double>(m - i + 1) * (k - i + 1)));
 
-		return d;
+	// The densities for non-centrality ncp are logdc[i] + i * log(ncp),
+	// normalised. Calculated in two passes using log-sum-exp, no copies.
+	auto max_density = [lo, &logdc](double lncp)
+	{
+		double result = -std::numeric_limits<double>::infinity();
+		for (size_t i = 0; i < logdc.size(); ++i)
+			result = std::max(result, logdc[i] + lncp * (lo + i));
+		return result;
 	};
 
-	auto d = dnhyper(1);
+	// p-value
+
+	double dmax = max_density(0);
+	double dsum = 0, dx = std::exp(logdc[x - lo] - dmax), tail = 0;
 
 	const double kRelErr = 1 + 1e-7;
 
-	switch (alternative)
+	for (auto i = lo; i <= hi; ++i)
 	{
-		case FisherAlternative::Left:
-			m_pvalue = std::accumulate(d.begin(), d.begin() + x - lo + 1, 0.0);
-			break;
+		double d = std::exp(logdc[i - lo] - dmax);
+		dsum += d;
 
-		case FisherAlternative::Right:
-			m_pvalue = std::accumulate(d.begin() + x - lo, d.end(), 0.0);
-			break;
+		switch (alternative)
+		{
+			case FisherAlternative::Left:
+				if (i <= x)
+					tail += d;
+				break;
 
-		default:
-			m_pvalue = std::accumulate(d.begin(), d.end(), 0.0,
-				[max = d[x - lo] * kRelErr](double s, double d)
-				{ return d <= max ? s + d : s; });
-			break;
+			case FisherAlternative::Right:
+				if (i >= x)
+					tail += d;
+				break;
+
+			default:
+				if (d <= dx * kRelErr)
+					tail += d;
+				break;
+		}
 	}
 
-	// calculate odds ratio
+	m_pvalue = tail / dsum;
+
+	// calculate odds ratio, the conditional MLE is the ncp for which the
+	// mean of the distribution equals x
 
-	auto mnhyper = [&dnhyper, lo, hi, logdc](double ncp)
+	auto mnhyper = [lo, hi, &logdc, &max_density](double ncp)
 	{
 		if (ncp == 0)
 			return lo * 1.0;
@@ -413,36 +547,75 @@ FishersExactTest::FishersExactTest(long v[2][2], FisherAlternative alternative)
 			return hi * 1.0;
 		else
 		{
-			auto d = dnhyper(ncp);
-
-			auto r = std::accumulate(d.begin(), d.end(), std::make_tuple(lo, 0.0), [](std::tuple<long,double> s, double di)
-				{
-					const auto &[i, ds] = s;
-					return std::make_tuple(i + 1, ds + di * i);
-				});
-			
-			return std::get<1>(r);
+			double lncp = std::log(ncp);
+			double dmax = max_density(lncp);
+
+			double s = 0, sx = 0;
+			for (size_t i = 0; i < logdc.size(); ++i)
+			{
+				double d = std::exp(logdc[i] + lncp * (lo + i) - dmax);
+				s += d;
+				sx += d * (lo + i);
+			}
+
+			return sx / s;
 		}
 	};
 
-	if (hi <= lo + 2)
-		m_oddsRatio = 1;
-	else
+	m_oddsRatio = 1;
+
+	if (hi > lo + 2)
 	{
-		try
+		double mu = mnhyper(1);
+
+		if (mu > x and x == lo)
+			;	// the root is at zero, zeroin cannot find it there and so this used to end up as 1
+		else if (mu < x and x == hi)
+			m_oddsRatio = std::numeric_limits<double>::infinity();
+		else if (mu != x)
 		{
-			double mu = mnhyper(1);
+			auto f = [x, &mnhyper](double t) { return mnhyper(t) - x; };
+
+			// Start with a bracket around the sample odds ratio and widen
+			// it until it contains the root, that takes only a few steps
+			// in practice.
+			double r = ((v[0][0] + 0.5) * (v[1][1] + 0.5)) / ((v[0][1] + 0.5) * (v[1][0] + 0.5));
+			double a = r, b = r;
 
 			if (mu > x)
-				m_oddsRatio = zeroin([x, &mnhyper](double t) { return mnhyper(t) - x; }, 0, 1);
-			else if (mu < x)
-				m_oddsRatio = 1 / zeroin([x, &mnhyper](double t) { return mnhyper(1 / t) - x; }, std::nextafter(0.0, 1.0), 1);
+				r = std::min(r, 1.0);
 			else
-				m_oddsRatio = 1;
-		}
-		catch (...)
-		{
-			m_oddsRatio = 1;
+				r = std::max(r, 1.0);
+
+			double fr = f(r);
+			if (fr == 0)
+				m_oddsRatio = r;
+			else
+			{
+				if (fr > 0)
+				{
+					b = r;
+					a = r / 2;
+					while (f(a) > 0 and a > std::numeric_limits<double>::min())
+						a /= 2;
+				}
+				else
+				{
+					a = r;
+					b = r * 2;
+					while (f(b) < 0 and b < std::numeric_limits<double>::max() / 2)
+						b *= 2;
+				}
+
+				try
+				{
+					m_oddsRatio = zeroin(f, a, b);
+				}
+				catch (...)
+				{
+					m_oddsRatio = 1;
+				}
+			}
 		}
 	}
 }
@@ -492,6 +665,11 @@ int main(int argc, char *const argv[])
 				  << "two.sided " << fisherTest2x2(p, FisherAlternative::TwoSided) << std::endl
 				  << "greater   " << fisherTest2x2(p, FisherAlternative::Right) << std::endl;
 
+		FisherEngine engine(p[0][0] + p[1][0], p[0][1] + p[1][1]);
+		std::cout << "less      " << engine(p, FisherAlternative::Left) << std::endl
+				  << "two.sided " << engine(p, FisherAlternative::TwoSided) << std::endl
+				  << "greater   " << engine(p, FisherAlternative::Right) << std::endl;
+
 		// odds
 		std::cout << "less      " << FishersExactTest(p, FisherAlternative::Left).oddsRatio() << std::endl
 				  << "two.sided " << FishersExactTest(p, FisherAlternative::TwoSided).oddsRatio() << std::endl
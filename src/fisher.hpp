@@ -26,8 +26,11 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
+#include "utils.hpp"
+
 enum class FisherAlternative {
 	Left, Right, TwoSided
 };
@@ -37,14 +40,75 @@ class FishersExactTest
   public:
 	FishersExactTest(long v[2][2], FisherAlternative alternative = FisherAlternative::TwoSided);
 
+	// Same, but using a caller owned scratch buffer. Reusing the buffer
+	// for a series of tests avoids all heap allocations.
+	FishersExactTest(long v[2][2], FisherAlternative alternative, std::vector<double> &scratch);
+
 	double pvalue() const			{ return m_pvalue; }
 	double oddsRatio() const		{ return m_oddsRatio; }
 
   private:
+	void calculate(long v[2][2], FisherAlternative alternative, std::vector<double> &logdc);
+
 	double m_pvalue;
 	double m_oddsRatio;
 };
 
 double fisherTest2x2(long v[2][2], FisherAlternative alternative = FisherAlternative::TwoSided);
 
+// Fisher's exact test for a series of 2x2 tables sharing the same column
+// totals, as is the case for all genes in an IP screen. The setup is done
+// once, evaluating a table does not allocate and is safe to do from
+// multiple threads at the same time.
+class FisherEngine
+{
+  public:
+	// column totals are v[0][0] + v[1][0] and v[0][1] + v[1][1]
+	FisherEngine(long column0, long column1);
+
+	double operator()(long v[2][2], FisherAlternative alternative = FisherAlternative::TwoSided) const;
+
+  private:
+	long m_k, m_N;
+};
+
+// A bounded memo of p-values, keyed on the complete table and alternative.
+// Most genes have low counts and so the same tables recur over and over,
+// across genes as well as screens. Safe to use from parallel_for workers.
+class FisherCache
+{
+  public:
+	static FisherCache &instance();
+
+	double operator()(long v[2][2], FisherAlternative alternative = FisherAlternative::TwoSided);
+	double operator()(const FisherEngine &engine, long v[2][2], FisherAlternative alternative = FisherAlternative::TwoSided);
+
+	using stats = memo_stats;
+
+	stats get_stats() const { return m_memo.get_stats(); }
+
+  private:
+	FisherCache() = default;
+	FisherCache(const FisherCache &) = delete;
+	FisherCache &operator=(const FisherCache &) = delete;
+
+	struct key
+	{
+		long v[4];
+		FisherAlternative alternative;
+
+		bool operator==(const key &rhs) const
+		{
+			return v[0] == rhs.v[0] and v[1] == rhs.v[1] and v[2] == rhs.v[2] and v[3] == rhs.v[3] and alternative == rhs.alternative;
+		}
+	};
+
+	struct key_hash
+	{
+		size_t operator()(const key &k) const;
+	};
+
+	sharded_memo<key, double, key_hash> m_memo;
+};
+
 std::vector<double> adjustFDR_BH(const std::vector<double>& p);
@@ -26,6 +26,7 @@
 
 #include "job-scheduler.hpp"
 #include "screen-service.hpp"
+#include "utils.hpp"
 
 #include <zeep/value-serializer.hpp>
 
@@ -85,6 +86,9 @@ job_scheduler& job_scheduler::instance()
 
 void job_scheduler::run()
 {
+	// jobs share the thread pool with the requests, those go first
+	scoped_priority priority(task_priority::background);
+
 	for (;;)
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
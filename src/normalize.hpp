@@ -0,0 +1,69 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ * 
+ * Copyright (c) 2022 NKI/AVL, Netherlands Cancer Institute
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+// --------------------------------------------------------------------
+// Split a list of \a listsize elements into consecutive groups of about
+// \a suggested_groupsize elements each.
+
+std::vector<std::tuple<size_t, size_t>> divide(size_t listsize, size_t suggested_groupsize);
+
+// --------------------------------------------------------------------
+// Normalisation of the sense counts of a screen against the control,
+// per group of genes with a similar sense ratio in the control.
+//
+// The genes taking part are stored ordered on their reference ratio,
+// as separate arrays so that each group is a contiguous range.
+
+class sense_normalizer
+{
+  public:
+	// Genes with a ratio of zero in either sample or reference do not
+	// take part. \a totals is the sum of sense and anti-sense counts.
+	sense_normalizer(const std::vector<double> &senseRatio, const std::vector<double> &refSenseRatio,
+		const std::vector<size_t> &totals);
+
+	size_t size() const { return m_gene.size(); }
+
+	// The original index of the i-th gene in order
+	uint32_t gene(size_t i) const { return m_gene[i]; }
+
+	// Calculate the normalised sense counts for the genes in group [b, e),
+	// storing them in sense[b] .. sense[e - 1]. Safe to call concurrently
+	// for different groups.
+	void normalize(size_t b, size_t e, int *sense) const;
+
+  private:
+	std::vector<uint32_t> m_gene;
+	std::vector<double> m_ref, m_sample, m_total;
+};
@@ -24,6 +24,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -419,9 +420,24 @@ std::vector<Transcript> loadGenes(const std::string& assembly, const std::string
 		if (VERBOSE > 1)
 			std::cerr << "Loading genes from " << transcript_selection << std::endl;
 
-		std::ifstream in(screen_service::instance().get_transcripts_dir() / (transcript_selection + ".tsv"));
-		
-		return loadGenes(in, completeOnly, knownOnly);
+		// custom selections are parsed once by the screen service
+		auto selection = screen_service::instance().load_transcript_selection(transcript_selection);
+
+		std::vector<Transcript> transcripts;
+		transcripts.reserve(selection->size());
+
+		for (auto& ts: *selection)
+		{
+			if (completeOnly and ts.cds.stat != CDSStat::COMPLETE)
+				continue;
+			
+			if (knownOnly and ts.name[0] != 'N')
+				continue;
+
+			transcripts.push_back(ts);
+		}
+
+		return transcripts;
 	}
 }
 
@@ -540,6 +556,81 @@ void cutOverlap(Transcript& a, Transcript& b)
 
 // --------------------------------------------------------------------
 
+TranscriptTable::TranscriptTable(const std::vector<Transcript>& transcripts)
+{
+	const size_t N = transcripts.size();
+
+	chrom.reserve(N);
+	strand.reserve(N);
+	start.reserve(N);
+	end.reserve(N);
+	range_offset.reserve(N + 1);
+	geneName.reserve(N);
+
+	size_t rangeCount = 0;
+	for (auto& t: transcripts)
+		rangeCount += t.ranges.size();
+
+	range_start.reserve(rangeCount);
+	range_end.reserve(rangeCount);
+
+	for (auto& t: transcripts)
+	{
+		chrom.push_back(t.chrom);
+		strand.push_back(t.strand);
+		start.push_back(t.start());
+		end.push_back(t.end());
+		geneName.push_back(t.geneName);
+
+		range_offset.push_back(range_start.size());
+		for (auto& r: t.ranges)
+		{
+			range_start.push_back(r.start);
+			range_end.push_back(r.end);
+		}
+	}
+
+	range_offset.push_back(range_start.size());
+}
+
+uint64_t TranscriptTable::fingerprint() const
+{
+	// FNV-1a
+	uint64_t result = 0xcbf29ce484222325ULL;
+
+	auto add = [&result](const void *data, size_t size)
+	{
+		auto p = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			result ^= p[i];
+			result *= 0x100000001b3ULL;
+		}
+	};
+
+	auto add_vector = [&add](const auto &v)
+	{
+		uint64_t n = v.size();
+		add(&n, sizeof(n));
+		add(v.data(), v.size() * sizeof(v[0]));
+	};
+
+	add_vector(chrom);
+	add_vector(strand);
+	add_vector(start);
+	add_vector(end);
+	add_vector(range_offset);
+	add_vector(range_start);
+	add_vector(range_end);
+
+	for (auto &name : geneName)
+		add(name.c_str(), name.length() + 1);
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
 void selectTranscripts(std::vector<Transcript>& transcripts, uint32_t maxGap, Mode mode)
 {
 	using std::vector;
@@ -572,19 +663,32 @@ void selectTranscripts(std::vector<Transcript>& transcripts, uint32_t maxGap, Mo
 		return d < 0;
 	});
 
-	// rename genes that are found on both strands or multiple chromosomes
-	for (size_t i = 0; i + 1 < transcripts.size(); ++i)
+	// The index is walked only once, one gene name at a time. Within a group
+	// the transcripts are ordered by chromosome and start position.
+
+	struct span
 	{
-		auto ix_a = index[i];
-		auto& a = transcripts[ix_a];
+		char strand;
+		size_t count;
+		uint32_t start, end;
+	};
+
+	vector<span> spans;
+	vector<span> following;
+
+	const size_t N = index.size();
 
-		size_t j = i;
+	for (size_t i = 0; i < N; )
+	{
+		auto& a = transcripts[index[i]];
+
+		// rename genes that are found on both strands or multiple chromosomes
+		size_t j = i + 1;
 		bool rename = false;
 
-		while (j + 1 < transcripts.size())
+		for (; j < N; ++j)
 		{
-			auto ix_b = index[j + 1];
-			auto& b = transcripts[ix_b];
+			auto& b = transcripts[index[j]];
 
 			if (b.geneName != a.geneName)
 				break;
@@ -596,96 +700,130 @@ void selectTranscripts(std::vector<Transcript>& transcripts, uint32_t maxGap, Mo
 				a.unique = false;
 				b.unique = false;
 			}
-
-			++j;
 		}
-		
-		if (not rename)
+
+		if (rename)
 		{
-			i = j;
-			continue;
+			for (size_t k = i; k < j; ++k)
+			{
+				auto& b = transcripts[index[k]];
+
+				std::stringstream s;
+				s << b.geneName << '@' << b.chrom << b.strand;
+				b.geneName = s.str();
+			}
 		}
 
-		for (size_t k = i; k <= j; ++k)
+		// [i, j) now contains all transcripts for this gene, select from them
+		switch (mode)
 		{
-			auto ix_b = index[k];
-			auto& b = transcripts[ix_b];
+			case Mode::LongestExon:
+			case Mode::LongestTranscript:
+				// Find the longest transcript for each run of name/chrom/strand.
+				// Each transcript is compared to the first in its run only, the
+				// last one that is longer than the first wins.
+				for (size_t r = i; r < j; )
+				{
+					auto ix_a = index[r];
+					auto& ra = transcripts[ix_a];
 
-			std::stringstream s;
-			s << b.geneName << '@' << b.chrom << b.strand;
-			b.geneName = s.str();
-		}
+					auto length = [mode](const Transcript& t)
+					{
+						return mode == Mode::LongestExon ? t.length_exons() : t.end() - t.start();
+					};
 
-		i = j;
-	}
+					auto l = ix_a;
+					auto len_a = length(ra);
 
-	switch (mode)
-	{
-		case Mode::LongestExon:
-			// Find the longest transcript for each gene
-			for (size_t i = 0; i < transcripts.size(); ++i)
-			{
-				auto ix_a = index[i];
-				auto& a = transcripts[ix_a];
+					for (++r; r < j; ++r)
+					{
+						auto ix_b = index[r];
+						auto& b = transcripts[ix_b];
 
-				auto l = ix_a;
+						if (b.chrom != ra.chrom or b.geneName != ra.geneName or ra.strand != b.strand)
+							break;
 
-				// auto len_a = a.end() - a.start();
-				auto len_a = a.length_exons();
+						if (length(b) > len_a)
+							l = ix_b;
+					}
 
-				for (size_t j = i + 1; j < transcripts.size(); ++j)
+					transcripts[l].longest = true;
+				}
+				break;
+
+			case Mode::Collapse:
+				// Find the longest possible span for each gene, i.e. min start - max end
+				for (size_t r = i; r < j; )
 				{
-					auto ix_b = index[j];
-					auto& b = transcripts[ix_b];
+					auto chrom = transcripts[index[r]].chrom;
 
-					if (b.chrom != a.chrom or b.geneName != a.geneName or a.strand != b.strand)
-						break;
+					size_t s = r + 1;
+					while (s < j and transcripts[index[s]].chrom == chrom)
+						++s;
 
-					++i;
+					// [r, s) is located on a single chromosome, the transcripts in
+					// here may still be on different strands. Collect for each
+					// transcript the span of all following transcripts on the same strand.
 
-					// auto len_b = b.end() - b.start();
-					auto len_b = b.length_exons();
-					if (len_b > len_a)
-						l = ix_b;
-				}
+					spans.clear();
+					following.resize(s - r);
 
-				transcripts[l].longest = true;
-			}
+					for (size_t k = s; k-- > r; )
+					{
+						auto& b = transcripts[index[k]];
 
-			transcripts.erase(
-				std::remove_if(transcripts.begin(), transcripts.end(), [](auto& t) { return not t.longest; }),
-				transcripts.end()
-			);			
-			break;
-		
-		case Mode::LongestTranscript:
-			// Find the longest transcript for each gene
-			for (size_t i = 0; i < transcripts.size(); ++i)
-			{
-				auto ix_a = index[i];
-				auto& a = transcripts[ix_a];
+						auto si = std::find_if(spans.begin(), spans.end(), [strand = b.strand](const span& sp) { return sp.strand == strand; });
+						if (si == spans.end())
+						{
+							spans.push_back({ b.strand, 0, std::numeric_limits<uint32_t>::max(), 0 });
+							si = spans.end() - 1;
+						}
 
-				auto l = ix_a;
+						following[k - r] = *si;
 
-				auto len_a = a.end() - a.start();
-				for (size_t j = i + 1; j < transcripts.size(); ++j)
-				{
-					auto ix_b = index[j];
-					auto& b = transcripts[ix_b];
+						si->count += 1;
+						if (si->start > b.start())
+							si->start = b.start();
+						if (si->end < b.end())
+							si->end = b.end();
+					}
 
-					if (b.chrom != a.chrom or b.geneName != a.geneName or a.strand != b.strand)
-						break;
+					// A transcript absorbs all that follow it on the same strand,
+					// the next count positions are skipped afterwards.
+					for (size_t k = r; k < s; )
+					{
+						auto& b = transcripts[index[k]];
+						auto& f = following[k - r];
+
+						b.longest = true;
+
+						if (f.count > 0)
+						{
+							if (b.start() > f.start)
+								b.start(f.start);
+							
+							if (b.end() < f.end)
+								b.end(f.end);
+						}
 
-					++i;
+						k += f.count + 1;
+					}
 
-					auto len_b = b.end() - b.start();
-					if (len_b > len_a)
-						l = ix_b;
+					r = s;
 				}
+				break;
 
-				transcripts[l].longest = true;
-			}
+			default:
+				break;
+		}
 
+		i = j;
+	}
+
+	switch (mode)
+	{
+		case Mode::LongestExon:
+		case Mode::LongestTranscript:
 			transcripts.erase(
 				std::remove_if(transcripts.begin(), transcripts.end(), [](auto& t) { return not t.longest; }),
 				transcripts.end()
@@ -693,34 +831,6 @@ void selectTranscripts(std::vector<Transcript>& transcripts, uint32_t maxGap, Mo
 			break;
 
 		case Mode::Collapse:
-			// Find the longest possible span for each gene, i.e. min start - max end
-			for (size_t i = 0; i < transcripts.size(); ++i)
-			{
-				auto ix_a = index[i];
-				auto& a = transcripts[ix_a];
-				a.longest = true;
-
-				for (size_t j = i + 1; j < transcripts.size(); ++j)
-				{
-					auto ix_b = index[j];
-					auto& b = transcripts[ix_b];
-
-					if (b.chrom != a.chrom)
-						break;
-
-					if (b.geneName != a.geneName or a.strand != b.strand)
-						continue;
-
-					++i;
-
-					if (a.start() > b.start())
-						a.start(b.start());
-					
-					if (a.end() < b.end())
-						a.end(b.end());
-				}
-			}
-
 			transcripts.erase(
 				std::remove_if(transcripts.begin(), transcripts.end(), [](auto& t) { return not (t.longest or t.unique); }),
 				transcripts.end()
@@ -742,8 +852,16 @@ std::vector<Transcript> loadTranscripts(const std::string& assembly, const std::
 	if (VERBOSE)
 		std::cerr << "Loaded " << transcripts.size() << " transcripts" << std::endl;
 
+	auto start = std::chrono::steady_clock::now();
+
 	filterTranscripts(transcripts, mode, startPos, endPos, cutOverlap);
 
+	if (VERBOSE)
+	{
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cerr << "Selected " << transcripts.size() << " transcripts in " << elapsed.count() << " seconds" << std::endl;
+	}
+
 	std::sort(transcripts.begin(), transcripts.end());
 
 	return transcripts;
@@ -147,10 +147,44 @@ struct Transcript
 
 void cutOverlap(Transcript& a, Transcript& b);
 
+// --------------------------------------------------------------------
+// A compact structure of arrays copy of the location info in a list of
+// transcripts. The analysis loops only need chromosome, strand and ranges
+// and having those in contiguous arrays is a lot friendlier for the cache.
+
+struct TranscriptTable
+{
+	TranscriptTable() = default;
+	explicit TranscriptTable(const std::vector<Transcript>& transcripts);
+
+	size_t size() const		{ return chrom.size(); }
+	bool empty() const		{ return chrom.empty(); }
+
+	// A hash over the contents, identifying this transcript set in
+	// data derived from it and stored on disk
+	uint64_t fingerprint() const;
+
+	std::vector<CHROM> chrom;
+	std::vector<char> strand;
+
+	// outer bounds, same as Transcript::start() and Transcript::end()
+	std::vector<uint32_t> start, end;
+
+	// the ranges for transcript i are at [range_offset[i], range_offset[i + 1])
+	std::vector<uint32_t> range_offset;
+	std::vector<uint32_t> range_start, range_end;
+
+	// side table
+	std::vector<std::string> geneName;
+};
+
 // --------------------------------------------------------------------
 
 void init_refseq(const std::string& file);
 
+// parse a refseq formatted gene table, the result is sorted
+std::vector<Transcript> loadGenes(std::istream& in, bool completeOnly, bool knownOnly);
+
 std::vector<Transcript> loadGenes(const std::string& assembly,
 	const std::string &transcript_selection, bool completeOnly, bool knownOnly);
 
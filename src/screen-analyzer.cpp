@@ -28,6 +28,7 @@
 #include "utils.hpp"
 #include "screen-data.hpp"
 #include "screen-server.hpp"
+#include "screen-service.hpp"
 #include "db-connection.hpp"
 #include "user-service.hpp"
 
@@ -43,6 +44,8 @@
 #include <fstream>
 #include <filesystem>
 
+#include <unistd.h>
+
 
 namespace po = boost::program_options;
 namespace fs = std::filesystem;
@@ -98,6 +101,17 @@ po::options_description get_config_options()
 		( "assembly",			po::value<std::string>(),	"Default assembly to use, currently one of hg19 or hg38")
 		( "trim-length",		po::value<unsigned>(),		"Trim reads to this length, default is 50")
 		( "threads",			po::value<unsigned>(),		"Nr of threads to use")
+		( "reserve-interactive",	po::value<unsigned>(),	"Nr of cores to keep free for interactive requests, default is 1")
+		( "reserve-batch",		po::value<unsigned>(),		"Nr of cores to keep free from background jobs like mapping, default is 0")
+		( "bowtie-nice",		po::value<int>(),			"Nice increment for bowtie processes started by the server, default is 10")
+		( "cache-memory",		po::value<size_t>(),		"Memory in MB to use for cached screen data, 0 for no limit, default is half the physical memory")
+		( "warm-up",			po::value<std::vector<std::string>>(),
+												"Cache to build at start up, as type:assembly:transcripts:mode:cut|no-cut:gene-start:gene-end. "
+												"May be repeated, use 'none' to build none. Default is the initial settings of the web pages for hg38")
+		( "index-memory",		po::value<size_t>(),		"Memory in MB to use at most for insertion indices, these are counted against cache-memory as well. Default is 0, no other limit")
+		( "sl-build-memory",	po::value<size_t>(),		"Memory in MB to use at most for insertions while building SL caches, default is 4096")
+		( "cache-populate",									"Read cache matrix files into memory completely when loading them")
+		( "cache-huge-pages",								"Ask for transparent huge pages for the cached screen data")
 		( "screen-dir",			po::value<std::string>(),	"Directory containing the screen data")
 		( "transcripts-dir",	po::value<std::string>(),	"Directory containing the transcript files")
 		( "bowtie-index-hg19",	po::value<std::string>(),	"Bowtie index parameter for HG19")
@@ -335,22 +349,23 @@ Examples:
 
 	// -----------------------------------------------------------------------
 
-	std::vector<Insertions> lowInsertions, highInsertions;
+	std::vector<InsertionTally> lowInsertions, highInsertions;
 
-	screenData.analyze(assembly, trimLength, transcripts, lowInsertions, highInsertions);
+	TranscriptTable table(transcripts);
+	screenData.analyze(assembly, trimLength, table, lowInsertions, highInsertions);
 
 	long lowSenseCount = 0, lowAntiSenseCount = 0;
 	for (auto& i: lowInsertions)
 	{
-		lowSenseCount += i.sense.size();
-		lowAntiSenseCount += i.antiSense.size();
+		lowSenseCount += i.sense;
+		lowAntiSenseCount += i.antiSense;
 	}
 
 	long highSenseCount = 0, highAntiSenseCount = 0;
 	for (auto& i: highInsertions)
 	{
-		highSenseCount += i.sense.size();
-		highAntiSenseCount += i.antiSense.size();
+		highSenseCount += i.sense;
+		highAntiSenseCount += i.antiSense;
 	}
 
 	// -----------------------------------------------------------------------
@@ -387,7 +402,7 @@ Examples:
 			  << "fcpv" << '\t'
 			  << "log2(mi)" << std::endl;
 
-	for (auto& dp: screenData.dataPoints(transcripts, lowInsertions, highInsertions, direction))
+	for (auto& dp: screenData.dataPoints(table, lowInsertions, highInsertions, direction))
 	{
 		std::cout << dp.gene << '\t'
 				<< dp.low << '\t'
@@ -460,7 +475,7 @@ or txEnd to have the start at the cdsEnd e.g.
 
 	// -----------------------------------------------------------------------
 
-	auto r = screenData.dataPoints(assembly, trimLength, transcripts, controlData, groupSize);
+	auto r = screenData.dataPoints(assembly, trimLength, TranscriptTable(transcripts), controlData, groupSize);
 	bool significantOnly = vm.count("significant");
 
 	if (vm.count("no-header") == 0)
@@ -892,7 +907,49 @@ Command should be either:
 	if (vm.count("threads"))
 		threads = vm["threads"].as<unsigned>();
 
-	bowtie_parameters::init(bowtie, threads, trimLength, assembly, assemblyIndices);
+	int bowtieNice = 10;
+	if (vm.count("bowtie-nice"))
+		bowtieNice = vm["bowtie-nice"].as<int>();
+
+	bowtie_parameters::init(bowtie, threads, trimLength, assembly, assemblyIndices, bowtieNice);
+
+	unsigned reserveInteractive = 1, reserveBatch = 0;
+	if (vm.count("reserve-interactive"))
+		reserveInteractive = vm["reserve-interactive"].as<unsigned>();
+	if (vm.count("reserve-batch"))
+		reserveBatch = vm["reserve-batch"].as<unsigned>();
+
+	thread_pool::instance().set_reservations(reserveInteractive, reserveBatch);
+
+	size_t cacheMemory = (static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE)) / 2;
+	if (vm.count("cache-memory"))
+		cacheMemory = vm["cache-memory"].as<size_t>() << 20;
+
+	screen_service::set_cache_memory_budget(cacheMemory);
+
+	if (vm.count("index-memory"))
+		screen_service::set_insertion_index_memory(vm["index-memory"].as<size_t>() << 20);
+	if (vm.count("sl-build-memory"))
+		screen_service::set_sl_build_memory(vm["sl-build-memory"].as<size_t>() << 20);
+
+	cache_block::set_options(vm.count("cache-populate"), vm.count("cache-huge-pages"));
+
+	std::vector<std::string> warmUp{
+		"ip:hg38:default:collapse:cut:txStart:cdsEnd",
+		"pa:hg38:default:longest-transcript:no-cut:txStart:cdsStart",
+		"sl:hg38:default:longest-transcript:no-cut:txStart:cdsEnd"
+	};
+	if (vm.count("warm-up"))
+		warmUp = vm["warm-up"].as<std::vector<std::string>>();
+
+	std::vector<cache_settings> warmUpSettings;
+	for (auto &w : warmUp)
+	{
+		if (w != "none")
+			warmUpSettings.push_back(cache_settings::parse(w));
+	}
+
+	screen_service::set_warm_up(warmUpSettings);
 
 	// --------------------------------------------------------------------
 
@@ -27,10 +27,13 @@
 #include <exception>
 #include <fstream>
 #include <future>
+#include <iomanip>
 #include <iostream>
 #include <regex>
 #include <stdexcept>
 
+#include <unistd.h>
+
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 
@@ -42,6 +45,7 @@
 #include "binom.hpp"
 #include "bowtie.hpp"
 #include "fisher.hpp"
+#include "normalize.hpp"
 #include "screen-data.hpp"
 #include "utils.hpp"
 
@@ -104,6 +108,12 @@ ScreenData::ScreenData(const fs::path &dir)
 {
 }
 
+ScreenData::ScreenData(const screen_info &info, const fs::path &dir)
+	: mDataDir(dir)
+	, mInfo(info)
+{
+}
+
 ScreenData::ScreenData(const fs::path &dir, const screen_info &info)
 	: mDataDir(dir)
 	, mInfo(info)
@@ -175,11 +185,11 @@ void ScreenData::addFile(const std::string &name, fs::path file)
 void ScreenData::map(const std::string &assembly)
 {
 	auto &params = bowtie_parameters::instance();
-	map(assembly, params.trimLength(), params.bowtie(), params.bowtieIndex(assembly), params.threads());
+	map(assembly, params.trimLength(), params.bowtie(), params.bowtieIndex(assembly), params.threads(), params.niceness());
 }
 
 void ScreenData::map(const std::string &assembly, unsigned trimLength,
-	fs::path bowtie, fs::path bowtieIndex, unsigned threads)
+	fs::path bowtie, fs::path bowtieIndex, unsigned threads, int niceness)
 {
 	const std::string kBowtieParams = "-m 1 --best";
 
@@ -214,7 +224,7 @@ void ScreenData::map(const std::string &assembly, unsigned trimLength,
 			continue;
 		name = name.stem();
 
-		auto hits = runBowtie(bowtie, bowtieIndex, p, bowtieLogFile, threads, trimLength);
+		auto hits = runBowtie(bowtie, bowtieIndex, p, bowtieLogFile, threads, trimLength, niceness);
 
 		std::ofstream logFile(bowtieLogFile, std::ios::app);
 		if (logFile.is_open())
@@ -226,6 +236,16 @@ void ScreenData::map(const std::string &assembly, unsigned trimLength,
 		mi.file.emplace_back(screen_insertion_count{ name, static_cast<uint32_t>(hits.size()) });
 	}
 
+	// the normalised counts were calculated from the previous mapping
+	if (mInfo.type == ScreenType::SyntheticLethal)
+	{
+		for (auto &f : SLScreenData::findNormalizedInsertionFiles(assemblyDataPath))
+		{
+			std::error_code ec;
+			fs::remove(f, ec);
+		}
+	}
+
 	mInfo.mappedInfo.erase(std::remove_if(mInfo.mappedInfo.begin(), mInfo.mappedInfo.end(), [=](auto &mi) { return mi.assembly == assembly and mi.trimlength == trimLength;}), mInfo.mappedInfo.end());
 	mInfo.mappedInfo.emplace_back(std::move(mi));
 
@@ -444,6 +464,71 @@ void ScreenData::write_insertions(const std::string &assembly, unsigned readLeng
 	outfile.close();
 }
 
+std::vector<std::string> ScreenData::get_insertion_files() const
+{
+	std::vector<std::string> result;
+
+	for (auto &f : mInfo.files)
+		result.push_back(f.name);
+
+	return result;
+}
+
+uint64_t ScreenData::input_fingerprint(const std::string &assembly, unsigned readLength) const
+{
+	return input_fingerprint(assembly, readLength, get_insertion_files());
+}
+
+uint64_t ScreenData::input_fingerprint(const std::string &assembly, unsigned readLength, const std::vector<std::string> &files) const
+{
+	// Only the size and the first block are hashed, the compressed files
+	// start with the insertion count followed by the positions for the
+	// first chromosomes, so any remapping changes these.
+	const size_t kHeaderSize = 4096;
+
+	// FNV-1a
+	uint64_t result = 0xcbf29ce484222325ULL;
+
+	auto add = [&result](const void *data, size_t size)
+	{
+		auto p = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			result ^= p[i];
+			result *= 0x100000001b3ULL;
+		}
+	};
+
+	fs::path dir = mDataDir / assembly / std::to_string(readLength);
+
+	for (auto &name : files)
+	{
+		fs::path file = dir / (name + ".sq");
+		if (not fs::exists(file))
+			file = dir / name;
+
+		add(name.data(), name.length());
+
+		std::error_code ec;
+		uint64_t size = fs::file_size(file, ec);
+		if (ec)
+			size = 0;
+
+		add(&size, sizeof(size));
+
+		std::ifstream in(file, std::ios::binary);
+		if (not in.is_open())
+			continue;
+
+		char header[kHeaderSize];
+		in.read(header, kHeaderSize);
+
+		add(header, in.gcount());
+	}
+
+	return result;
+}
+
 // --------------------------------------------------------------------
 
 screen_info ScreenData::loadManifest(const std::filesystem::path &dir)
@@ -648,6 +733,55 @@ void ScreenData::compress_map(const std::string &assembly, unsigned readLength,
 	outfile.close();
 }
 
+// --------------------------------------------------------------------
+// Walk the sorted list of insertions and call f(t, sense, pos) for every
+// exon range of transcript t that contains the insertion. Transcripts
+// should be sorted on chromosome and start position.
+
+template <typename F>
+void for_each_hit(const TranscriptTable &transcripts, const std::vector<Insertion> &bwt, F &&f)
+{
+	const size_t N = transcripts.size();
+
+	const CHROM *chrom = transcripts.chrom.data();
+	const char *tstrand = transcripts.strand.data();
+	const uint32_t *tstart = transcripts.start.data();
+	const uint32_t *tend = transcripts.end.data();
+	const uint32_t *roffset = transcripts.range_offset.data();
+	const uint32_t *rstart = transcripts.range_start.data();
+	const uint32_t *rend = transcripts.range_end.data();
+
+#if DEBUG
+	for (size_t t = 1; t < N; ++t)
+		assert(chrom[t - 1] < chrom[t] or (chrom[t - 1] == chrom[t] and tstart[t - 1] <= tstart[t]));
+
+	// the duplicate check in count_hits depends on this
+	assert(std::adjacent_find(bwt.begin(), bwt.end(), [](auto &a, auto &b) { return not (a < b); }) == bwt.end());
+#endif
+
+	size_t ts = 0;
+
+	for (const auto &[chr, strand, pos] : bwt)
+	{
+		assert(chr != CHROM::INVALID);
+
+		// we have a valid hit at chr:pos, see if it matches a transcript
+
+		// skip all that are before the current position
+		while (ts < N and (chrom[ts] < chr or (chrom[ts] == chr and tend[ts] <= pos)))
+			++ts;
+
+		for (size_t t = ts; t < N and chrom[t] == chr and tstart[t] <= pos; ++t)
+		{
+			for (uint32_t r = roffset[t]; r < roffset[t + 1]; ++r)
+			{
+				if (pos >= rstart[r] and pos < rend[r])
+					f(t, strand == tstrand[t], pos);
+			}
+		}
+	}
+}
+
 // --------------------------------------------------------------------
 
 IPPAScreenData::IPPAScreenData(ScreenType type, const fs::path &dir)
@@ -664,85 +798,146 @@ IPPAScreenData::IPPAScreenData(ScreenType type, const fs::path &dir, const scree
 {
 }
 
-void IPPAScreenData::analyze(const std::string &assembly, unsigned readLength, const std::vector<Transcript> &transcripts,
-	std::vector<Insertions> &lowInsertions, std::vector<Insertions> &highInsertions)
+IPPAScreenData::IPPAScreenData(ScreenType type, const screen_info &info, const fs::path &dir)
+	: ScreenData(info, dir)
+	, mType(type)
 {
-	// reorder transcripts based on chr > end-position, makes code easier and faster
-#if DEBUG
-	auto tc = transcripts;
-	std::stable_sort(tc.begin(), tc.end());
-	assert(tc == transcripts);
-#endif
+	if (mInfo.type != mType)
+		throw std::runtime_error("This screen is not of the specified type");
+}
 
-	std::list<std::thread> t;
-	std::exception_ptr eptr;
+inline void add_insertion(InsertionTally &insertions, bool sense, uint32_t pos)
+{
+	if (sense)
+		insertions.sense += 1;
+	else
+		insertions.antiSense += 1;
+}
 
-	for (std::string s : { "low", "high" })
-	{
-#ifndef DEBUG
-		t.emplace_back([&, lh = s]()
-			{
-#else
-		auto lh = s;
-#endif
-				try
-				{
-					auto bwt = read_insertions(assembly, readLength, lh);
+inline void add_insertion(Insertions &insertions, bool sense, uint32_t pos)
+{
+	if (sense)
+		insertions.sense.push_back(pos);
+	else
+		insertions.antiSense.push_back(pos);
+}
 
-					std::vector<Insertions> insertions(transcripts.size());
+// Count the distinct insertions per transcript
+template <typename T>
+std::vector<T> count_hits(const TranscriptTable &transcripts, const std::vector<Insertion> &bwt, const std::string &lh)
+{
+	std::vector<T> insertions(transcripts.size());
 
-					auto ts = transcripts.begin();
+	// Insertions arrive sorted and unique, the only way to see
+	// one twice for a transcript is through overlapping ranges
+	// and then the calls are consecutive.
+	size_t lastT = transcripts.size();
+	uint32_t lastPos = 0;
+	bool lastSense = false;
 
-					for (const auto &[chr, strand, pos] : bwt)
-					{
-						assert(chr != CHROM::INVALID);
+	for_each_hit(transcripts, bwt, [&](size_t t, bool sense, uint32_t pos)
+		{
+		if (VERBOSE >= 3)
+			std::cerr << "hit " << transcripts.geneName[t] << " " << lh << " " << (sense ? "sense" : "anti-sense") << std::endl;
 
-						// we have a valid hit at chr:pos, see if it matches a transcript
+		if (t == lastT and pos == lastPos and sense == lastSense)
+			return;
 
-						// skip all that are before the current position
-						while (ts != transcripts.end() and (ts->chrom < chr or (ts->chrom == chr and ts->end() <= pos)))
-							++ts;
+		lastT = t;
+		lastPos = pos;
+		lastSense = sense;
 
-						auto t = ts;
-						while (t != transcripts.end() and t->chrom == chr and t->start() <= pos)
-						{
-							if (VERBOSE >= 3)
-								std::cerr << "hit " << t->geneName << " " << lh << " " << (strand == t->strand ? "sense" : "anti-sense") << std::endl;
-
-							for (auto &r : t->ranges)
-							{
-								if (pos >= r.start and pos < r.end)
-								{
-									if (strand == t->strand)
-										insertions[t - transcripts.begin()].sense.insert(pos);
-									else
-										insertions[t - transcripts.begin()].antiSense.insert(pos);
-								}
-							}
-
-							++t;
-						}
-					}
+		add_insertion(insertions[t], sense, pos); });
 
-					if (lh == "low")
-						std::swap(insertions, lowInsertions);
-					else
-						std::swap(insertions, highInsertions);
-				}
-				catch (...)
-				{
-					eptr = std::current_exception();
-				}
-#ifndef DEBUG
-			});
-#endif
+	return insertions;
+}
+
+// Same as count_hits<InsertionTally> but using an index, this costs
+// O(log n) per exon range instead of a pass over all insertions. The
+// ranges of a transcript are sorted, overlaps are counted only once.
+std::vector<InsertionTally> count_hits(const TranscriptTable &transcripts, const InsertionIndex &index)
+{
+	const size_t N = transcripts.size();
+
+	std::vector<InsertionTally> insertions(N);
+
+	for (size_t t = 0; t < N; ++t)
+	{
+		CHROM chr = transcripts.chrom[t];
+		char strand = transcripts.strand[t];
+		char otherStrand = strand == '+' ? '-' : '+';
+
+		uint32_t covered = transcripts.start[t];
+
+		for (uint32_t r = transcripts.range_offset[t]; r < transcripts.range_offset[t + 1]; ++r)
+		{
+			uint32_t start = std::max(transcripts.range_start[r], covered);
+			uint32_t end = std::min(transcripts.range_end[r], transcripts.end[t]);
+
+			if (start >= end)
+				continue;
+
+			insertions[t].sense += index.count(chr, strand, start, end);
+			insertions[t].antiSense += index.count(chr, otherStrand, start, end);
+
+			covered = end;
+		}
 	}
 
-	for (auto &ti : t)
-		ti.join();
+	return insertions;
+}
 
-	if (eptr)
-		std::rethrow_exception(eptr);
+std::vector<std::string> IPPAScreenData::get_insertion_files() const
+{
+	return { "low", "high" };
+}
+
+std::array<std::vector<Insertion>, 2> IPPAScreenData::read_low_high(const std::string &assembly, unsigned readLength) const
+{
+	return { read_insertions(assembly, readLength, "low"), read_insertions(assembly, readLength, "high") };
+}
+
+void IPPAScreenData::analyze(const TranscriptTable &transcripts, const std::array<std::vector<Insertion>, 2> &lowHigh,
+	std::vector<InsertionTally> &lowInsertions, std::vector<InsertionTally> &highInsertions)
+{
+	lowInsertions = count_hits<InsertionTally>(transcripts, lowHigh[0], "low");
+	highInsertions = count_hits<InsertionTally>(transcripts, lowHigh[1], "high");
+}
+
+void IPPAScreenData::analyze(const TranscriptTable &transcripts, const std::array<InsertionIndex, 2> &lowHigh,
+	std::vector<InsertionTally> &lowInsertions, std::vector<InsertionTally> &highInsertions)
+{
+	lowInsertions = count_hits(transcripts, lowHigh[0]);
+	highInsertions = count_hits(transcripts, lowHigh[1]);
+}
+
+void IPPAScreenData::analyze(const std::string &assembly, unsigned readLength, const TranscriptTable &transcripts,
+	std::vector<InsertionTally> &lowInsertions, std::vector<InsertionTally> &highInsertions)
+{
+	accumulate_insertions(assembly, readLength, transcripts, lowInsertions, highInsertions);
+}
+
+void IPPAScreenData::analyze(const std::string &assembly, unsigned readLength, const TranscriptTable &transcripts,
+	std::vector<Insertions> &lowInsertions, std::vector<Insertions> &highInsertions)
+{
+	accumulate_insertions(assembly, readLength, transcripts, lowInsertions, highInsertions);
+}
+
+template <typename T>
+void IPPAScreenData::accumulate_insertions(const std::string &assembly, unsigned readLength, const TranscriptTable &transcripts,
+	std::vector<T> &lowInsertions, std::vector<T> &highInsertions)
+{
+	parallel_for(2, [&](size_t i)
+		{
+		std::string lh = i == 0 ? "low" : "high";
+
+		auto bwt = read_insertions(assembly, readLength, lh);
+		auto insertions = count_hits<T>(transcripts, bwt, lh);
+
+		if (lh == "low")
+			std::swap(insertions, lowInsertions);
+		else
+			std::swap(insertions, highInsertions); });
 
 	if (lowInsertions.size() != transcripts.size() or highInsertions.size() != transcripts.size())
 		throw std::runtime_error("Failed to calculate analysis");
@@ -757,44 +952,27 @@ IPPAScreenData::insertions(const std::string &assembly, CHROM chrom, uint32_t st
 
 	std::vector<uint32_t> lowP, lowM, highP, highM;
 
-	std::list<std::thread> t;
-	std::exception_ptr eptr;
+	parallel_for(2, [&](size_t i)
+		{
+		std::string lh = i == 0 ? "low" : "high";
 
-	for (std::string s : { "low", "high" })
-	{
-		t.emplace_back([&, lh = s]()
-			{
-			try
-			{
-				std::vector<uint32_t> &insP = lh == "low" ? lowP : highP;
-				std::vector<uint32_t> &insM = lh == "low" ? lowM : highM;
+		std::vector<uint32_t> &insP = lh == "low" ? lowP : highP;
+		std::vector<uint32_t> &insM = lh == "low" ? lowM : highM;
 
-				auto bwt = read_insertions(assembly, readLength, lh);
+		auto bwt = read_insertions(assembly, readLength, lh);
 
-				for (auto &&[chr, strand, pos] : bwt)
-				{
-					assert(chr != CHROM::INVALID);
+		for (auto &&[chr, strand, pos] : bwt)
+		{
+			assert(chr != CHROM::INVALID);
 
-					if (chr == chrom and pos >= start and pos < end)
-					{
-						if (strand == '+')
-							insP.push_back(pos);
-						else
-							insM.push_back(pos);
-					}
-				}
-			}
-			catch (...)
+			if (chr == chrom and pos >= start and pos < end)
 			{
-				eptr = std::current_exception();
-			} });
-	}
-
-	for (auto &ti : t)
-		ti.join();
-
-	if (eptr)
-		std::rethrow_exception(eptr);
+				if (strand == '+')
+					insP.push_back(pos);
+				else
+					insM.push_back(pos);
+			}
+		} });
 
 	return std::make_tuple(std::move(highP), std::move(highM), std::move(lowP), std::move(lowM));
 }
@@ -807,19 +985,19 @@ std::vector<IPDataPoint> IPPAScreenData::dataPoints(const std::string &assembly,
 {
 	const unsigned readLength = 50;
 
-	auto transcripts = loadTranscripts(assembly, transcript_selection, mode, geneStart, geneEnd, cutOverlap);
+	TranscriptTable transcripts(loadTranscripts(assembly, transcript_selection, mode, geneStart, geneEnd, cutOverlap));
 
 	// -----------------------------------------------------------------------
 
-	std::vector<Insertions> lowInsertions, highInsertions;
+	std::vector<InsertionTally> lowInsertions, highInsertions;
 
 	analyze(assembly, readLength, transcripts, lowInsertions, highInsertions);
 
 	return dataPoints(transcripts, lowInsertions, highInsertions, direction);
 }
 
-std::vector<IPDataPoint> IPPAScreenData::dataPoints(const std::vector<Transcript> &transcripts,
-	const std::vector<Insertions> &lowInsertions, const std::vector<Insertions> &highInsertions,
+std::vector<IPDataPoint> IPPAScreenData::dataPoints(const TranscriptTable &transcripts,
+	const std::vector<InsertionTally> &lowInsertions, const std::vector<InsertionTally> &highInsertions,
 	Direction direction)
 {
 	auto countLowHigh = [direction, &lowInsertions, &highInsertions](size_t i) -> std::tuple<long, long>
@@ -828,18 +1006,18 @@ std::vector<IPDataPoint> IPPAScreenData::dataPoints(const std::vector<Transcript
 		switch (direction)
 		{
 			case Direction::Sense:
-				low = lowInsertions[i].sense.size();
-				high = highInsertions[i].sense.size();
+				low = lowInsertions[i].sense;
+				high = highInsertions[i].sense;
 				break;
 
 			case Direction::AntiSense:
-				low = lowInsertions[i].antiSense.size();
-				high = highInsertions[i].antiSense.size();
+				low = lowInsertions[i].antiSense;
+				high = highInsertions[i].antiSense;
 				break;
 
 			case Direction::Both:
-				low = lowInsertions[i].sense.size() + lowInsertions[i].antiSense.size();
-				high = highInsertions[i].sense.size() + highInsertions[i].antiSense.size();
+				low = lowInsertions[i].sense + lowInsertions[i].antiSense;
+				high = highInsertions[i].sense + highInsertions[i].antiSense;
 				break;
 		}
 		return { low, high };
@@ -856,9 +1034,11 @@ std::vector<IPDataPoint> IPPAScreenData::dataPoints(const std::vector<Transcript
 	std::vector<double> pvalues(transcripts.size(), 0);
 	std::vector<IPDataPoint> result(transcripts.size());
 
+	// all tables share the same column totals
+	FisherEngine fisher(lowCount, highCount);
+
 	parallel_for(transcripts.size(), [&](size_t i)
 		{
-		auto &t = transcripts[i];
 		auto &p = result[i];
 
 		std::tie(p.low, p.high) = countLowHigh(i);
@@ -880,9 +1060,9 @@ std::vector<IPDataPoint> IPPAScreenData::dataPoints(const std::vector<Transcript
 			{p.low, p.high},
 			{lowCount - p.low, highCount - p.high}};
 
-		pvalues[i] = fisherTest2x2(v);
+		pvalues[i] = FisherCache::instance()(fisher, v);
 
-		p.gene = t.geneName;
+		p.gene = transcripts.geneName[i];
 		p.pv = pvalues[i];
 		p.mi = ((miH / miHT) / (miL / miLT)); });
 
@@ -908,6 +1088,13 @@ SLScreenData::SLScreenData(const fs::path &dir, const screen_info &info)
 {
 }
 
+SLScreenData::SLScreenData(const screen_info &info, const fs::path &dir)
+	: ScreenData(info, dir)
+{
+	if (mInfo.type != screen_type)
+		throw std::runtime_error("This screen is not of the specified type");
+}
+
 std::vector<std::string> SLScreenData::getReplicateNames() const
 {
 	std::vector<std::string> result;
@@ -919,7 +1106,107 @@ std::vector<std::string> SLScreenData::getReplicateNames() const
 }
 
 std::array<std::vector<InsertionCount>, 4> SLScreenData::loadNormalizedInsertions(const std::string &assembly, unsigned trimLength,
-	const std::vector<Transcript> &transcripts, unsigned groupSize) const
+	const TranscriptTable &transcripts, unsigned groupSize) const
+{
+	const size_t N = transcripts.size();
+
+	fs::path dir = mDataDir / assembly / std::to_string(trimLength);
+
+	std::stringstream ss;
+	ss << "normalized-" << std::hex << std::setw(16) << std::setfill('0') << transcripts.fingerprint()
+	   << std::dec << '-' << groupSize;
+	fs::path cf = dir / ss.str();
+
+	std::error_code ec;
+
+	// the stored counts start with the fingerprint of the replicates
+	// they were calculated from
+	uint64_t fingerprint = input_fingerprint(assembly, trimLength, { "replicate-1", "replicate-2", "replicate-3", "replicate-4" });
+
+	std::array<std::vector<InsertionCount>, 4> result;
+
+	if (fs::exists(cf, ec) and fs::file_size(cf, ec) == sizeof(fingerprint) + 4 * N * sizeof(InsertionCount))
+	{
+		std::ifstream in(cf, std::ios::binary);
+
+		uint64_t stored = 0;
+		in.read(reinterpret_cast<char *>(&stored), sizeof(stored));
+
+		if (in and stored == fingerprint)
+		{
+			for (auto &r : result)
+			{
+				r.resize(N);
+				in.read(reinterpret_cast<char *>(r.data()), N * sizeof(InsertionCount));
+			}
+
+			if (in)
+				return result;
+		}
+	}
+
+	result = calculateNormalizedInsertions(assembly, trimLength, transcripts, groupSize);
+
+	// write to a temporary file first, another cache may be reading
+	fs::path tmp = cf;
+	tmp += ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+	bool written;
+
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&fingerprint), sizeof(fingerprint));
+		for (auto &r : result)
+			out.write(reinterpret_cast<const char *>(r.data()), N * sizeof(InsertionCount));
+
+		out.close();
+		written = static_cast<bool>(out);
+	}
+
+	// do not publish a short write, e.g. on a full disk
+	if (written)
+		fs::rename(tmp, cf, ec);
+
+	if (not written or ec)
+	{
+		if (VERBOSE)
+			std::cerr << "Could not store normalized control insertions in " << cf << (ec ? ": " + ec.message() : "") << std::endl;
+		fs::remove(tmp, ec);
+	}
+
+	return result;
+}
+
+std::vector<fs::path> SLScreenData::findNormalizedInsertionFiles(const fs::path &dir, const std::set<uint64_t> &keep)
+{
+	std::vector<fs::path> result;
+
+	std::error_code ec;
+	for (auto &f : fs::directory_iterator(dir, ec))
+	{
+		// names are normalized-<transcripts fingerprint>-<group size>,
+		// temporary files being written are left alone
+		auto name = f.path().filename().string();
+		if (name.compare(0, 11, "normalized-") != 0 or name.find(".tmp") != std::string::npos)
+			continue;
+
+		try
+		{
+			if (keep.count(std::stoull(name.substr(11, 16), nullptr, 16)))
+				continue;
+		}
+		catch (const std::exception &)
+		{
+		}
+
+		result.push_back(f.path());
+	}
+
+	return result;
+}
+
+std::array<std::vector<InsertionCount>, 4> SLScreenData::calculateNormalizedInsertions(const std::string &assembly, unsigned trimLength,
+	const TranscriptTable &transcripts, unsigned groupSize) const
 {
 	// First load the control data
 	std::array<std::vector<InsertionCount>, 4> controlInsertions;
@@ -959,15 +1246,29 @@ std::array<std::vector<InsertionCount>, 4> SLScreenData::loadNormalizedInsertion
 }
 
 std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, unsigned trimLength,
-	const std::vector<Transcript> &transcripts, const SLScreenData &controlData, unsigned groupSize)
+	const TranscriptTable &transcripts, const SLScreenData &controlData, unsigned groupSize)
 {
 	auto normalizedControlInsertions = controlData.loadNormalizedInsertions(assembly, trimLength, transcripts, groupSize);
 	return dataPoints(assembly, trimLength, transcripts, normalizedControlInsertions, groupSize);
 }
 
 std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, unsigned trimLength,
-	const std::vector<Transcript> &transcripts,
+	const TranscriptTable &transcripts,
 	const std::array<std::vector<InsertionCount>, 4> &normalizedControlInsertions, unsigned groupSize)
+{
+	std::vector<SLDataPoint> result(transcripts.size());
+
+	dataPoints(assembly, trimLength, transcripts, normalizedControlInsertions, groupSize,
+		[&result](size_t i, const SLDataPoint &dp)
+		{ result[i] = dp; });
+
+	return result;
+}
+
+void SLScreenData::dataPoints(const std::string &assembly, unsigned trimLength,
+	const TranscriptTable &transcripts,
+	const std::array<std::vector<InsertionCount>, 4> &normalizedControlInsertions, unsigned groupSize,
+	const std::function<void(size_t, const SLDataPoint &)> &sink)
 {
 	std::exception_ptr eptr;
 
@@ -999,8 +1300,7 @@ std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, u
 
 	// merge data, calculate odds ratio
 
-	std::vector<SLDataPoint> result(transcripts.size());
-	parallel_for(result.size(), [&](size_t i)
+	parallel_for(transcripts.size(), [&](size_t i)
 		{
 		try
 		{
@@ -1008,7 +1308,9 @@ std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, u
 				Undefined, Up, Down, Inconsistent
 			} check = ConsistencyCheck::Undefined;
 
-			auto &dp = result[i];
+			// reused for all genes handled by this thread
+			static thread_local SLDataPoint dp;
+			dp.replicates.clear();
 
 			size_t s_g = 0, a_g = 0;
 
@@ -1066,14 +1368,18 @@ std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, u
 				{ static_cast<long>(s_wt), static_cast<long>(a_wt) },
 			};
 
-			FishersExactTest f(v, FisherAlternative::Right);
+			// reuse the buffer for all genes handled by this thread
+			static thread_local std::vector<double> scratch;
+			FishersExactTest f(v, FisherAlternative::Right, scratch);
 
-			dp.gene = transcripts[i].geneName;
+			dp.gene = transcripts.geneName[i];
 			dp.oddsRatio = f.oddsRatio();
 			dp.senseRatio = (1.0f + s_g) / (2.0f + s_g + a_g);
 			dp.controlBinom = binom_test(s_wt, s_wt + a_wt);
 			dp.controlSenseRatio = (1.0f + s_wt) / (2.0f + s_wt + a_wt);
 			dp.consistent = check != ConsistencyCheck::Inconsistent;
+
+			sink(i, dp);
 		}
 		catch (const std::exception &e)
 		{
@@ -1082,32 +1388,6 @@ std::vector<SLDataPoint> SLScreenData::dataPoints(const std::string &assembly, u
 
 	if (eptr)
 		std::rethrow_exception(eptr);
-
-	return result;
-}
-
-// --------------------------------------------------------------------
-
-std::vector<std::tuple<size_t, size_t>> divide(size_t listsize, size_t suggested_groupsize)
-{
-	size_t nrOfGroups = std::round(static_cast<float>(listsize) / suggested_groupsize);
-	float groupsize = static_cast<float>(listsize) / nrOfGroups;
-
-	std::vector<std::tuple<size_t, size_t>> result;
-
-	size_t b = 0;
-	for (float i = groupsize; i < listsize; i += groupsize)
-	{
-		size_t e = static_cast<size_t>(std::floor(i));
-		result.emplace_back(b, e);
-		b = e;
-	}
-
-	// due to rounding errors, the last may be incorrect
-	if (not result.empty())
-		std::get<1>(result.back()) = listsize;
-
-	return result;
 }
 
 // --------------------------------------------------------------------
@@ -1145,116 +1425,53 @@ std::vector<InsertionCount> SLScreenData::normalize(const std::vector<InsertionC
 			refSenseRatio[i] = (ref_sense + 1.0f) / (ref_sense + ref_antisense + 2);
 		} });
 
-	// collect the datapoints with both counts in sample and in reference
+	// collect the datapoints with both counts in sample and in reference,
+	// ordered on ref_ratio
 
-	std::vector<size_t> index;
-	index.reserve(insertions.size());
+	std::vector<size_t> totals(insertions.size());
 	for (size_t i = 0; i < insertions.size(); ++i)
-	{
-		if (senseRatio[i] <= 0 or refSenseRatio[i] <= 0)
-			continue;
+		totals[i] = insertions[i].sense + insertions[i].antiSense;
 
-		index.push_back(i);
-	}
+	sense_normalizer normalizer(senseRatio, refSenseRatio, totals);
 
-	// sort datapoints based on ref_ratio
-	std::sort(index.begin(), index.end(),
-		[&refSenseRatio](size_t a, size_t b)
-		{ return refSenseRatio[a] < refSenseRatio[b]; });
+	auto groups = divide(normalizer.size(), groupSize);
 
-	auto groups = divide(index.size(), groupSize);
+	std::vector<int> sense(normalizer.size());
 
 	parallel_for(groups.size(), [&](size_t i)
 		{
 		const auto &[b, e] = groups[i];
-		auto l = e - b;
-
-		// calculate median ratio for sample and reference in this group
-		// The median for ref can be picked up immediately since the
-		// group is already sorted on this value
-		double ref_median;
-
-		if (l & 1)
-		{
-			auto ix = (e + b) / 2 + 1;
-			ref_median = refSenseRatio[index[ix]];
-		}
-		else
-		{
-			auto ix = (e + b) / 2;
-			ref_median = (refSenseRatio[index[ix]] + refSenseRatio[index[ix + 1]]) / 2.0;
-		}
-
-		// median for sample needs to be calculated
-		std::vector<double> srs;
-		for (auto ix = b; ix < e; ++ix)
-			srs.push_back(senseRatio[index[ix]]);
-		std::sort(srs.begin(), srs.end());
-		double sample_median = l & 1
-								   ? srs[l / 2 + 1]
-								   : (srs[l / 2] + srs[l / 2 + 1]) / 2.0;
-
-		// adjust counts
-		for (size_t ix = b; ix < e; ++ix)
-		{
-			auto iix = index[ix];
-			assert(iix < insertions.size());
-
-			auto iSenseRatio = senseRatio[iix];
-
-			double f = iSenseRatio < sample_median
-						   ? (ref_median * iSenseRatio) / sample_median
-						   : 1 - ((1 - ref_median) * (1 - iSenseRatio)) / (1 - sample_median);
+		normalizer.normalize(b, e, sense.data()); });
 
-			if (f > 1)
-				f = 1;
+	// adjust counts
+	for (size_t i = 0; i < normalizer.size(); ++i)
+	{
+		auto iix = normalizer.gene(i);
+		assert(iix < insertions.size());
 
-			auto total = insertions[iix].sense + insertions[iix].antiSense;
-			result[iix].sense = static_cast<int>(std::round(f * (total)));
-			result[iix].antiSense = total - result[iix].sense;
-		} });
+		result[iix].sense = sense[i];
+		result[iix].antiSense = totals[iix] - result[iix].sense;
+	}
 
 	return result;
 }
 
 void SLScreenData::count_insertions(const std::string &replicate, const std::string &assembly, unsigned trimLength,
-	const std::vector<Transcript> &transcripts, std::vector<InsertionCount> &insertions) const
+	const TranscriptTable &transcripts, std::vector<InsertionCount> &insertions) const
 {
 	insertions.resize(transcripts.size());
 
 	auto bwt = read_insertions(assembly, trimLength, replicate);
-	auto ts = transcripts.begin();
 
-	for (const auto &[chr, strand, pos] : bwt)
-	{
-		assert(chr != CHROM::INVALID);
-
-		// we have a valid hit at chr:pos, see if it matches a transcript
-
-		// skip all that are before the current position
-		while (ts != transcripts.end() and (ts->chrom < chr or (ts->chrom == chr and ts->end() <= pos)))
-			++ts;
-
-		auto t = ts;
-		while (t != transcripts.end() and t->chrom == chr and t->start() <= pos)
+	for_each_hit(transcripts, bwt, [&](size_t t, bool sense, uint32_t pos)
 		{
-			for (auto &r : t->ranges)
-			{
-				if (pos >= r.start and pos < r.end)
-				{
-					if (VERBOSE >= 3)
-						std::cerr << "hit\t" << t->geneName << "\t" << pos << "\t" << (strand == t->strand ? "sense" : "anti-sense") << std::endl;
+		if (VERBOSE >= 3)
+			std::cerr << "hit\t" << transcripts.geneName[t] << "\t" << pos << "\t" << (sense ? "sense" : "anti-sense") << std::endl;
 
-					if (strand == t->strand)
-						insertions[t - transcripts.begin()].sense += 1;
-					else
-						insertions[t - transcripts.begin()].antiSense += 1;
-				}
-			}
-
-			++t;
-		}
-	}
+		if (sense)
+			insertions[t].sense += 1;
+		else
+			insertions[t].antiSense += 1; });
 }
 
 std::tuple<std::vector<uint32_t>, std::vector<uint32_t>> SLScreenData::getInsertionsForReplicate(const std::string &replicate,
@@ -1289,7 +1506,7 @@ std::tuple<std::vector<uint32_t>, std::vector<uint32_t>> SLScreenData::getInsert
 // 	const std::vector<InsertionCount> &insertions,
 // 	const std::array<std::vector<InsertionCount>, 4> &controlInsertions,
 // 	unsigned groupSize)
-std::vector<SLDataReplicate> SLScreenData::dataPoints(const std::vector<Transcript> &transcripts,
+std::vector<SLDataReplicate> SLScreenData::dataPoints(const TranscriptTable &transcripts,
 	const std::vector<InsertionCount> &insertions,
 	const std::array<std::vector<InsertionCount>, 4> &controlInsertions, unsigned groupSize)
 {
@@ -1349,7 +1566,7 @@ std::vector<SLDataReplicate> SLScreenData::dataPoints(const std::vector<Transcri
 			if (v[0][0] + v[0][1] == 0 or v[1][0] + v[1][1] == 0)
 				repl.ref_pv[j] = -1;
 			else
-				repl.ref_pv[j] = fisherTest2x2(v);
+				repl.ref_pv[j] = FisherCache::instance()(v);
 		} });
 
 	std::vector<double> fcpv;
@@ -1367,18 +1584,21 @@ std::vector<SLDataReplicate> SLScreenData::dataPoints(const std::vector<Transcri
 
 std::unique_ptr<ScreenData> ScreenData::load(const fs::path &dir)
 {
-	screen_info info = loadManifest(dir);
+	return load(dir, loadManifest(dir));
+}
 
+std::unique_ptr<ScreenData> ScreenData::load(const fs::path &dir, const screen_info &info)
+{
 	switch (info.type)
 	{
 		case ScreenType::IntracellularPhenotype:
-			return std::make_unique<IPScreenData>(dir);
+			return std::make_unique<IPScreenData>(info, dir);
 
 		case ScreenType::IntracellularPhenotypeActivation:
-			return std::make_unique<PAScreenData>(dir);
+			return std::make_unique<PAScreenData>(info, dir);
 
 		case ScreenType::SyntheticLethal:
-			return std::make_unique<SLScreenData>(dir);
+			return std::make_unique<SLScreenData>(info, dir);
 
 		default:
 			throw std::logic_error("should not be called with unspecified");
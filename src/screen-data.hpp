@@ -28,6 +28,7 @@
 
 #include <list>
 #include <filesystem>
+#include <set>
 
 #include <zeep/nvp.hpp>
 #include <zeep/json/element.hpp> 
@@ -297,9 +298,13 @@ class ScreenData
 
 	static std::unique_ptr<ScreenData> load(const std::filesystem::path& dir);
 
+	// Same, for a screen whose manifest \a info was read before, e.g. by
+	// the registry in screen_service
+	static std::unique_ptr<ScreenData> load(const std::filesystem::path& dir, const screen_info& info);
+
 	virtual void map(const std::string& assembly, unsigned readLength,
 		std::filesystem::path bowtie, std::filesystem::path bowtieIndex,
-		unsigned threads);
+		unsigned threads, int niceness = 0);
 
 	virtual void map(const std::string& assembly);
 
@@ -316,6 +321,10 @@ class ScreenData
 	static uint32_t count_insertions(std::filesystem::path file);
 	static uint32_t count_insertions(const std::string& assembly, unsigned readLength, const std::string& file);
 
+	// A hash over the size and header of each of the insertion files used
+	// in the analysis, identifying the input of data derived from them
+	uint64_t input_fingerprint(const std::string& assembly, unsigned readLength) const;
+
 	// load and save screen_info from the manifest file
 	static screen_info loadManifest(const std::filesystem::path& dir);
 	static void saveManifest(const screen_info& info, const std::filesystem::path& dir);
@@ -325,6 +334,11 @@ class ScreenData
 
   protected:
 
+	// The names of the insertion files the analysis reads
+	virtual std::vector<std::string> get_insertion_files() const;
+
+	uint64_t input_fingerprint(const std::string& assembly, unsigned readLength, const std::vector<std::string>& files) const;
+
 	std::vector<Insertion> read_insertions(const std::string& assembly, unsigned readLength, const std::string& file) const;
 	void write_insertions(const std::string& assembly, unsigned readLength, const std::string& file,
 		std::vector<Insertion>& insertions);
@@ -332,6 +346,9 @@ class ScreenData
 	ScreenData(const std::filesystem::path& dir);
 	ScreenData(const std::filesystem::path& dir, const screen_info& info);
 
+	// existing screen in \a dir with manifest \a info
+	ScreenData(const screen_info& info, const std::filesystem::path& dir);
+
 	std::filesystem::path mDataDir;
 	screen_info mInfo;
 };
@@ -350,11 +367,29 @@ class IPPAScreenData : public ScreenData
 		return std::unique_ptr<IPPAScreenData>(static_cast<IPPAScreenData*>(result.release()));
 	}
 
-	// note: will reorder transcripts!
+	// note: transcripts should be sorted on chromosome and start position
+	void analyze(const std::string& assembly, unsigned readLength,
+		const TranscriptTable& transcripts,
+		std::vector<InsertionTally>& lowInsertions, std::vector<InsertionTally>& highInsertions);
+
+	// variant of analyze that also collects the positions
 	void analyze(const std::string& assembly, unsigned readLength,
-		const std::vector<Transcript>& transcripts,
+		const TranscriptTable& transcripts,
 		std::vector<Insertions>& lowInsertions, std::vector<Insertions>& highInsertions);
 
+	// Two stage variant for batch processing, reading the insertions is
+	// I/O bound, the counting is CPU bound and done in the calling thread
+	std::array<std::vector<Insertion>, 2> read_low_high(const std::string& assembly, unsigned readLength) const;
+
+	void analyze(const TranscriptTable& transcripts, const std::array<std::vector<Insertion>, 2>& lowHigh,
+		std::vector<InsertionTally>& lowInsertions, std::vector<InsertionTally>& highInsertions);
+
+	// Same, but counting using an index on the low and high insertions
+	// which is much cheaper when analysing the same screen for different
+	// gene windows.
+	void analyze(const TranscriptTable& transcripts, const std::array<InsertionIndex, 2>& lowHigh,
+		std::vector<InsertionTally>& lowInsertions, std::vector<InsertionTally>& highInsertions);
+
 	std::tuple<std::vector<uint32_t>, std::vector<uint32_t>, std::vector<uint32_t>, std::vector<uint32_t>>
 		insertions(const std::string& assembly, CHROM chrom, uint32_t start, uint32_t end);
 
@@ -362,14 +397,22 @@ class IPPAScreenData : public ScreenData
 		bool cutOverlap, const std::string& geneStart, const std::string& geneEnd,
 		Direction direction);
 
-	std::vector<IPDataPoint> dataPoints(const std::vector<Transcript>& transcripts,
-		const std::vector<Insertions>& lowInsertions, const std::vector<Insertions>& highInsertions,
+	std::vector<IPDataPoint> dataPoints(const TranscriptTable& transcripts,
+		const std::vector<InsertionTally>& lowInsertions, const std::vector<InsertionTally>& highInsertions,
 		Direction direction);
 
   protected:
 
+	std::vector<std::string> get_insertion_files() const override;
+
+	template<typename T>
+	void accumulate_insertions(const std::string& assembly, unsigned readLength,
+		const TranscriptTable& transcripts,
+		std::vector<T>& lowInsertions, std::vector<T>& highInsertions);
+
 	IPPAScreenData(ScreenType type, const std::filesystem::path& dir);
 	IPPAScreenData(ScreenType type, const std::filesystem::path& dir, const screen_info& info);
+	IPPAScreenData(ScreenType type, const screen_info& info, const std::filesystem::path& dir);
 
 	ScreenType mType;
 };
@@ -383,6 +426,8 @@ class IPScreenData : public IPPAScreenData
 		: IPPAScreenData(ScreenType::IntracellularPhenotype, dir) {}
 	IPScreenData(const std::filesystem::path& dir, const screen_info& info)
 		: IPPAScreenData(ScreenType::IntracellularPhenotype, dir, info) {}
+	IPScreenData(const screen_info& info, const std::filesystem::path& dir)
+		: IPPAScreenData(ScreenType::IntracellularPhenotype, info, dir) {}
 };
 
 class PAScreenData : public IPPAScreenData
@@ -394,6 +439,8 @@ class PAScreenData : public IPPAScreenData
 		: IPPAScreenData(ScreenType::IntracellularPhenotypeActivation, dir) {}
 	PAScreenData(const std::filesystem::path& dir, const screen_info& info)
 		: IPPAScreenData(ScreenType::IntracellularPhenotypeActivation, dir, info) {}
+	PAScreenData(const screen_info& info, const std::filesystem::path& dir)
+		: IPPAScreenData(ScreenType::IntracellularPhenotypeActivation, info, dir) {}
 };
 
 // --------------------------------------------------------------------
@@ -410,17 +457,33 @@ class SLScreenData : public ScreenData
 
 	SLScreenData(const std::filesystem::path& dir);
 	SLScreenData(const std::filesystem::path& dir, const screen_info& info);
+	SLScreenData(const screen_info& info, const std::filesystem::path& dir);
 
 	static std::unique_ptr<IPPAScreenData> create(const screen_info& info, const std::filesystem::path& dir);
 
+	// The normalised counts of the four control replicates. These are stored
+	// in the screen directory, keyed by transcript set and group size, along
+	// with the fingerprint of the replicates, and recalculated only when the
+	// replicates were mapped again.
 	std::array<std::vector<InsertionCount>,4> loadNormalizedInsertions(const std::string& assembly, unsigned readLength,
-		const std::vector<Transcript>& transcripts, unsigned groupSize) const;
+		const TranscriptTable& transcripts, unsigned groupSize) const;
+
+	// The stored normalised counts in \a dir, an <assembly>/<trim length>
+	// directory, except those for the transcript fingerprints in \a keep
+	static std::vector<std::filesystem::path> findNormalizedInsertionFiles(const std::filesystem::path& dir,
+		const std::set<uint64_t>& keep = {});
 
 	std::vector<SLDataPoint> dataPoints(const std::string& assembly, unsigned readLength,
-		const std::vector<Transcript>& transcripts, const std::array<std::vector<InsertionCount>,4>& controlInsertions, unsigned groupSize);
+		const TranscriptTable& transcripts, const std::array<std::vector<InsertionCount>,4>& controlInsertions, unsigned groupSize);
+
+	// Variant that hands each data point to \a sink as soon as it is
+	// calculated, called concurrently for different genes
+	void dataPoints(const std::string& assembly, unsigned readLength,
+		const TranscriptTable& transcripts, const std::array<std::vector<InsertionCount>,4>& controlInsertions, unsigned groupSize,
+		const std::function<void(size_t, const SLDataPoint&)>& sink);
 
 	std::vector<SLDataPoint> dataPoints(const std::string& assembly, unsigned readLength,
-		const std::vector<Transcript>& transcripts, const SLScreenData& controlData, unsigned groupSize);
+		const TranscriptTable& transcripts, const SLScreenData& controlData, unsigned groupSize);
 
 	std::vector<std::string> getReplicateNames() const;
 	std::tuple<std::vector<uint32_t>,std::vector<uint32_t>> getInsertionsForReplicate(
@@ -428,13 +491,16 @@ class SLScreenData : public ScreenData
 
   private:
 
+	std::array<std::vector<InsertionCount>,4> calculateNormalizedInsertions(const std::string& assembly, unsigned readLength,
+		const TranscriptTable& transcripts, unsigned groupSize) const;
+
 	static std::vector<InsertionCount> normalize(const std::vector<InsertionCount>& counts,
 		const std::array<std::vector<InsertionCount>,4>& controlInsertions, unsigned groupSize);
 
 	void count_insertions(const std::string& replicate, const std::string& assembly, unsigned readLength,
-		const std::vector<Transcript>& transcripts, std::vector<InsertionCount>& insertions) const;
+		const TranscriptTable& transcripts, std::vector<InsertionCount>& insertions) const;
 
-	std::vector<SLDataReplicate> dataPoints(const std::vector<Transcript>& transcripts,
+	std::vector<SLDataReplicate> dataPoints(const TranscriptTable& transcripts,
 		const std::vector<InsertionCount>& insertions,
 		const std::array<std::vector<InsertionCount>,4>& controlInsertions, unsigned groupSize);
 
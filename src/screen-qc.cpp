@@ -28,6 +28,7 @@
 
 #include "screen-qc.hpp"
 #include "screen-service.hpp"
+#include "utils.hpp"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
@@ -174,7 +175,7 @@ float InsertionCounts::zscore(const std::string &screen, size_t bin) const
 
 // --------------------------------------------------------------------
 
-InsertionCounts createIndex(RefSeqInfo &refseq, std::vector<std::tuple<std::string, fs::path>> &files, size_t nrOfThreads)
+InsertionCounts createIndex(RefSeqInfo &refseq, std::vector<std::tuple<std::string, fs::path>> &files)
 {
 	if (VERBOSE)
 		std::cout << "About to read " << files.size() << " files" << std::endl;
@@ -187,53 +188,38 @@ InsertionCounts createIndex(RefSeqInfo &refseq, std::vector<std::tuple<std::stri
 
 	size_t maxBin = refseq.binCount - 1;
 
-	std::vector<std::thread> t;
-	std::atomic<size_t> next(0);
 	std::mutex m;
 
-	for (size_t ti = 0; ti < nrOfThreads; ++ti)
-	{
-		t.emplace_back([&]()
-			{
-			for (;;)
-			{
-				size_t ix = next++;
-				if (ix >= files.size())
-					break;
+	parallel_for(files.size(), [&](size_t ix)
+		{
+		const auto& [name, file] = files[ix];
 
-				const auto& [name, file] = files[ix];
+		try
+		{
+			std::vector<uint16_t> counts(refseq.binCount, 0);
+			size_t count = 0;
 
-				try
-				{
-					std::vector<uint16_t> counts(refseq.binCount, 0);
-					size_t count = 0;
-
-					for (auto& ins: ScreenData::read_insertions(file))
-					{
-						size_t bin = refseq.bin(ins.chr, ins.pos + 1);
-						if (bin >= maxBin)
-							throw std::runtime_error("bin '" + std::to_string(bin) + "' out of range in file " + file.string());
-						
-						counts[bin] += 1;
-						++count;
-					}
-
-					std::lock_guard lock(m);
-
-					inscnt.add(name, move(counts));
-					std::cout << '.';
-					std::cout.flush();
-				}
-				catch(const std::exception& e)
-				{
-					std::cerr << "Error parsing file " << file << std::endl
-						 << e.what() << std::endl;
-				}
-			} });
-	}
+			for (auto& ins: ScreenData::read_insertions(file))
+			{
+				size_t bin = refseq.bin(ins.chr, ins.pos + 1);
+				if (bin >= maxBin)
+					throw std::runtime_error("bin '" + std::to_string(bin) + "' out of range in file " + file.string());
+				
+				counts[bin] += 1;
+				++count;
+			}
 
-	for (size_t ti = 0; ti < nrOfThreads; ++ti)
-		t[ti].join();
+			std::lock_guard lock(m);
+
+			inscnt.add(name, move(counts));
+			std::cout << '.';
+			std::cout.flush();
+		}
+		catch(const std::exception& e)
+		{
+			std::cerr << "Error parsing file " << file << std::endl
+				 << e.what() << std::endl;
+		} });
 
 	std::cout << std::endl
 			  << "calculating statistics...";
@@ -400,7 +386,7 @@ screen_qc_data::screen_qc_data()
 		}
 	}
 
-	auto stats = createIndex(refseq, files, std::thread::hardware_concurrency());
+	auto stats = createIndex(refseq, files);
 
 	m_binCount = refseq.binCount;
 	m_binSize = refseq.binSize;
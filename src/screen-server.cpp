@@ -883,6 +883,8 @@ zh::server *createServer(const fs::path &docroot,
 	server->add_controller(new screen_rest_controller());
 	server->add_controller(new screen_html_controller());
 
+	server->add_controller(new health_controller());
+
 	// admin
 	server->add_controller(new user_admin_rest_controller());
 	server->add_controller(new user_admin_html_controller());
@@ -919,5 +921,7 @@ zh::server *createPublicServer(const fs::path &docroot,
 	server->add_controller(new SLScreenRestController(screenDir));
 	server->add_controller(new SLScreenHtmlController(screenDir, true));
 
+	server->add_controller(new health_controller());
+
 	return server;
 }
@@ -27,6 +27,7 @@
 #include "screen-service.hpp"
 #include "bowtie.hpp"
 #include "db-connection.hpp"
+#include "fisher.hpp"
 #include "job-scheduler.hpp"
 #include "user-service.hpp"
 #include "utils.hpp"
@@ -37,13 +38,480 @@
 
 #include <zeep/crypto.hpp>
 
+#include <chrono>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <optional>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
 extern int VERBOSE;
 
+// The number of screens reading insertions from disk at the same time
+// while building a cache
+const size_t kMaxConcurrentReads = 4;
+
+// The version of the analysis whose results are stored in the cache
+// files, increment this when a change invalidates the cached results
+const uint32_t kCacheAlgorithmVersion = 1;
+
+// --------------------------------------------------------------------
+
+static void report_fisher_cache()
+{
+	if (VERBOSE)
+	{
+		auto stats = FisherCache::instance().get_stats();
+		std::cerr << "Fisher p-value cache: " << stats.hits << " hits, " << stats.misses << " misses ("
+				  << std::fixed << std::setprecision(1) << 100 * stats.hit_rate() << "% hit rate), "
+				  << stats.size << " of " << stats.capacity << " entries in use" << std::defaultfloat << std::endl;
+	}
+}
+
+// --------------------------------------------------------------------
+
+bool cache_block::s_populate = false, cache_block::s_huge_pages = false;
+
+void cache_block::set_options(bool populate, bool huge_pages)
+{
+	s_populate = populate;
+	s_huge_pages = huge_pages;
+}
+
+cache_block::cache_block(size_t size)
+{
+	// anonymous mapped memory is zero filled and only takes up space once
+	// a screen is actually filled in
+	if (size > 0)
+	{
+		void *block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			throw std::runtime_error("Could not allocate " + std::to_string(size) + " bytes for the screen data cache");
+
+		m_data = static_cast<char *>(block);
+		m_size = size;
+
+#if defined(MADV_HUGEPAGE)
+		if (s_huge_pages)
+			madvise(m_data, m_size, MADV_HUGEPAGE);
+#endif
+	}
+}
+
+cache_block::cache_block(const fs::path &file, size_t offset, size_t size)
+{
+	if (size > 0)
+	{
+		int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Could not open " + file.string() + ": " + strerror(errno));
+
+		// a private writable mapping, writes never end up in the file
+		int flags = MAP_PRIVATE;
+		if (s_populate)
+			flags |= MAP_POPULATE;
+
+		void *block = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+		int err = errno;
+
+		close(fd);
+
+		if (block == MAP_FAILED)
+			throw std::runtime_error("Could not map " + file.string() + ": " + strerror(err));
+
+		m_data = static_cast<char *>(block);
+		m_size = size;
+	}
+}
+
+cache_block::cache_block(cache_block &&rhs) noexcept
+	: m_data(std::exchange(rhs.m_data, nullptr))
+	, m_size(std::exchange(rhs.m_size, 0))
+{
+}
+
+cache_block &cache_block::operator=(cache_block &&rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		if (m_data != nullptr)
+			munmap(m_data, m_size);
+
+		m_data = std::exchange(rhs.m_data, nullptr);
+		m_size = std::exchange(rhs.m_size, 0);
+	}
+
+	return *this;
+}
+
+cache_block::~cache_block()
+{
+	if (m_data != nullptr)
+		munmap(m_data, m_size);
+}
+
+// --------------------------------------------------------------------
+// The cache files. The matrix file is a header followed by the settings,
+// the screens and, page aligned, the data block. A per-screen cache file
+// is a header followed by the data for that screen.
+
+namespace
+{
+
+const char kMatrixMagic[8] = { 'P', 'H', 'S', 'M', 'T', 'R', 'X', 0 };
+const uint32_t kMatrixVersion = 2;
+const uint64_t kMatrixDataAlignment = 64 * 1024;
+
+struct matrix_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t gene_count;
+	uint64_t transcripts_fingerprint;
+	uint32_t screen_count;
+	int32_t trim_length;
+	uint32_t settings_size;
+	uint32_t algorithm_version;
+	uint64_t data_offset;
+	uint64_t data_size;
+};
+
+struct matrix_screen
+{
+	bool filled;
+	uint8_t file_count;
+	uint64_t input_fingerprint;
+	std::string name;
+};
+
+const char kCacheFileMagic[8] = { 'P', 'H', 'S', 'C', 'A', 'C', 'H', 'E' };
+
+struct cache_file_header
+{
+	char magic[8];
+	uint32_t algorithm_version;
+	uint32_t reserved;
+	uint64_t transcripts_fingerprint;
+	uint64_t input_fingerprint;
+};
+
+// Read the header, settings and screens from a matrix file, returns false
+// if this is not a matrix file we can use.
+bool read_matrix_header(std::istream &in, matrix_header &header, std::string &settings, std::vector<matrix_screen> &screens)
+{
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+	if (not in or memcmp(header.magic, kMatrixMagic, sizeof(kMatrixMagic)) != 0 or header.version != kMatrixVersion)
+		return false;
+
+	settings.resize(header.settings_size);
+	in.read(settings.data(), settings.size());
+
+	for (uint32_t i = 0; in and i < header.screen_count; ++i)
+	{
+		uint8_t filled, file_count;
+		uint16_t length;
+		uint64_t input_fingerprint;
+
+		in.read(reinterpret_cast<char *>(&filled), sizeof(filled));
+		in.read(reinterpret_cast<char *>(&file_count), sizeof(file_count));
+		in.read(reinterpret_cast<char *>(&length), sizeof(length));
+		in.read(reinterpret_cast<char *>(&input_fingerprint), sizeof(input_fingerprint));
+
+		std::string name(length, 0);
+		in.read(name.data(), length);
+
+		screens.push_back({ filled != 0, file_count, input_fingerprint, std::move(name) });
+	}
+
+	return static_cast<bool>(in);
+}
+
+// The matrix files in \a dir along with their header and settings, used
+// to warm up the caches that were in use before a restart
+struct matrix_file_info
+{
+	fs::path file;
+	matrix_header header;
+	std::string settings;
+	fs::file_time_type last_write;
+};
+
+std::vector<matrix_file_info> scan_matrix_files(const fs::path &dir)
+{
+	std::vector<matrix_file_info> result;
+
+	std::error_code ec;
+	for (auto &f : fs::directory_iterator(dir, ec))
+	{
+		if (f.path().extension() != ".matrix")
+			continue;
+
+		try
+		{
+			std::ifstream in(f.path(), std::ios::binary);
+
+			matrix_file_info info{ f.path() };
+			std::vector<matrix_screen> screens;
+
+			if (not read_matrix_header(in, info.header, info.settings, screens))
+				continue;
+
+			info.last_write = fs::last_write_time(f.path());
+
+			result.push_back(std::move(info));
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Could not read cache matrix " << f.path() << ": " << ex.what() << std::endl;
+		}
+	}
+
+	return result;
+}
+
+void remove_matrix_file(const fs::path &file)
+{
+	std::error_code ec;
+	fs::remove(file, ec);
+	if (ec)
+		std::cerr << "Could not remove cache matrix " << file << ": " << ec.message() << std::endl;
+}
+
+} // namespace
+
+std::optional<cache_block> screen_data_cache::load_matrix(size_t data_size)
+{
+	auto file = get_matrix_file_path();
+
+	std::error_code ec;
+	if (not fs::exists(file, ec))
+		return {};
+
+	try
+	{
+		std::ifstream in(file, std::ios::binary);
+
+		matrix_header header;
+		std::string settings;
+		std::vector<matrix_screen> screens;
+
+		if (not read_matrix_header(in, header, settings, screens) or
+			header.gene_count != m_transcript_set->transcripts.size() or
+			header.transcripts_fingerprint != m_transcript_set->fingerprint or
+			header.algorithm_version != kCacheAlgorithmVersion or
+			header.data_size != data_size or
+			header.data_offset + header.data_size != fs::file_size(file) or
+			screens.size() != m_screens.size())
+		{
+			return {};
+		}
+
+		for (size_t si = 0; si < m_screens.size(); ++si)
+		{
+			if (screens[si].name != m_screens[si].name or screens[si].file_count != m_screens[si].file_count)
+				return {};
+		}
+
+		cache_block result(file, header.data_offset, header.data_size);
+
+		// screens whose insertions changed since are calculated again
+		size_t stale = 0;
+
+		for (size_t si = 0; si < m_screens.size(); ++si)
+		{
+			m_screens[si].filled = screens[si].filled and screens[si].input_fingerprint == m_screens[si].input_fingerprint;
+			if (screens[si].filled and not m_screens[si].filled)
+				++stale;
+		}
+
+		if (VERBOSE)
+			std::cerr << "loaded cache matrix " << file.filename() << ", " << stale << " screens out of date" << std::endl;
+
+		return result;
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not load cache matrix " << file << ": " << ex.what() << std::endl;
+		return {};
+	}
+}
+
+void screen_data_cache::write_matrix_file(const cache_block &block) const
+{
+	auto file = get_matrix_file_path();
+	auto tmp = file;
+	tmp += ".tmp";
+
+	try
+	{
+		if (not fs::exists(file.parent_path()))
+			fs::create_directories(file.parent_path());
+
+		std::stringstream ss;
+		ss << zeep::value_serializer<ScreenType>::to_string(m_type)
+		   << ':' << m_assembly
+		   << ':' << m_transcript_selection
+		   << ':' << zeep::value_serializer<Mode>::to_string(m_mode)
+		   << ':' << (m_cutOverlap ? "cut" : "no-cut")
+		   << ':' << m_geneStart
+		   << ':' << m_geneEnd;
+		auto settings = ss.str();
+
+		matrix_header header = {};
+		memcpy(header.magic, kMatrixMagic, sizeof(kMatrixMagic));
+		header.version = kMatrixVersion;
+		header.gene_count = m_transcript_set->transcripts.size();
+		header.transcripts_fingerprint = m_transcript_set->fingerprint;
+		header.screen_count = m_screens.size();
+		header.trim_length = m_trim_length;
+		header.settings_size = settings.length();
+		header.algorithm_version = kCacheAlgorithmVersion;
+		header.data_size = block.size();
+
+		size_t offset = sizeof(header) + settings.length();
+		for (auto &screen : m_screens)
+			offset += 4 + sizeof(screen.input_fingerprint) + screen.name.length();
+		header.data_offset = (offset + kMatrixDataAlignment - 1) / kMatrixDataAlignment * kMatrixDataAlignment;
+
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		out.write(settings.data(), settings.length());
+
+		for (auto &screen : m_screens)
+		{
+			uint8_t filled = screen.filled;
+			uint16_t length = screen.name.length();
+
+			out.write(reinterpret_cast<const char *>(&filled), sizeof(filled));
+			out.write(reinterpret_cast<const char *>(&screen.file_count), sizeof(screen.file_count));
+			out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+			out.write(reinterpret_cast<const char *>(&screen.input_fingerprint), sizeof(screen.input_fingerprint));
+			out.write(screen.name.data(), length);
+		}
+
+		out.seekp(header.data_offset);
+		out.write(block.data(), block.size());
+		out.close();
+
+		if (not out)
+			throw std::runtime_error("error writing file");
+
+		// replace in one go, mappings of the old file stay valid
+		fs::rename(tmp, file);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not write cache matrix " << file << ": " << ex.what() << std::endl;
+
+		std::error_code ec;
+		fs::remove(tmp, ec);
+	}
+}
+
+void screen_data_cache::set_input_fingerprints(const screen_data_cache *base, const std::set<std::string> &changed, uint64_t salt)
+{
+	auto &service = screen_service::instance();
+	auto screenDataDir = service.get_screen_data_dir();
+
+	// the manifests come from the registry, only the insertion file
+	// headers are read, but there may be many screens
+	parallel_for(m_screens.size(), [&](size_t si)
+		{
+		auto &screen = m_screens[si];
+
+		if (base != nullptr and not changed.count(screen.name))
+		{
+			auto bi = std::find_if(base->m_screens.begin(), base->m_screens.end(), [&screen](auto &bs)
+				{ return bs.name == screen.name; });
+
+			if (bi != base->m_screens.end())
+			{
+				screen.input_fingerprint = bi->input_fingerprint;
+				return;
+			}
+		}
+
+		try
+		{
+			auto data = ScreenData::load(screenDataDir / screen.name, service.retrieve_screen(screen.name));
+			screen.input_fingerprint = data->input_fingerprint(m_assembly, m_trim_length) ^ salt;
+		}
+		catch (const std::exception &ex)
+		{
+			// no stored data will match, the screen is calculated again
+			std::cerr << "Could not determine the input fingerprint for screen " << screen.name << ": " << ex.what() << std::endl;
+			screen.input_fingerprint = 0;
+		} });
+}
+
+bool screen_data_cache::read_cache_file(const cached_screen &screen, std::initializer_list<std::pair<void *, size_t>> parts) const
+{
+	auto cf = get_cache_file_path(screen.name);
+
+	size_t size = sizeof(cache_file_header);
+	for (auto &[data, length] : parts)
+		size += length;
+
+	std::error_code ec;
+	if (not fs::exists(cf, ec) or fs::file_size(cf, ec) != size)
+		return false;
+
+	std::ifstream fcf(cf, std::ios::binary);
+
+	cache_file_header header;
+	fcf.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+	if (not fcf or memcmp(header.magic, kCacheFileMagic, sizeof(kCacheFileMagic)) != 0 or
+		header.algorithm_version != kCacheAlgorithmVersion or
+		header.transcripts_fingerprint != m_transcript_set->fingerprint or
+		header.input_fingerprint != screen.input_fingerprint)
+	{
+		if (VERBOSE)
+			std::cerr << "cache file for " << screen.name << " is out of date" << std::endl;
+		return false;
+	}
+
+	for (auto &[data, length] : parts)
+		fcf.read(static_cast<char *>(data), length);
+
+	return static_cast<bool>(fcf);
+}
+
+void screen_data_cache::write_cache_file(const cached_screen &screen, std::initializer_list<std::pair<const void *, size_t>> parts) const
+{
+	auto cf = get_cache_file_path(screen.name);
+
+	if (fs::exists(cf))
+		fs::remove(cf);
+
+	if (not fs::exists(cf.parent_path()))
+		fs::create_directories(cf.parent_path());
+
+	cache_file_header header = {};
+	memcpy(header.magic, kCacheFileMagic, sizeof(kCacheFileMagic));
+	header.algorithm_version = kCacheAlgorithmVersion;
+	header.transcripts_fingerprint = m_transcript_set->fingerprint;
+	header.input_fingerprint = screen.input_fingerprint;
+
+	std::ofstream fcf(cf, std::ios::binary);
+
+	fcf.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	for (auto &[data, length] : parts)
+		fcf.write(static_cast<const char *>(data), length);
+}
+
 // --------------------------------------------------------------------
 
 class gene_ranking
@@ -89,7 +557,29 @@ screen_data_cache::screen_data_cache(ScreenType type, const std::string &assembl
 	, m_geneStart(geneStart)
 	, m_geneEnd(geneEnd)
 {
-	m_transcripts = loadTranscripts(assembly, transcript_selection, mode, geneStart, geneEnd, cutOverlap);
+	m_transcript_set = make_transcript_set(loadTranscripts(assembly, transcript_selection, mode, geneStart, geneEnd, cutOverlap));
+}
+
+std::shared_ptr<const screen_data_cache::transcript_set> screen_data_cache::make_transcript_set(std::vector<Transcript> &&transcripts)
+{
+	auto result = std::make_shared<transcript_set>();
+
+	result->transcripts = std::move(transcripts);
+	result->table = TranscriptTable(result->transcripts);
+	result->fingerprint = result->table.fingerprint();
+
+	return result;
+}
+
+uint64_t screen_data_cache::get_transcripts_fingerprint(const cache_settings &settings)
+{
+	auto transcripts = loadTranscripts(settings.assembly, settings.transcript_selection, settings.mode,
+		settings.gene_start, settings.gene_end, settings.cut_overlap);
+
+	if (settings.type == ScreenType::SyntheticLethal)
+		sl_screen_data_cache::prepare_transcripts(transcripts);
+
+	return TranscriptTable(transcripts).fingerprint();
 }
 
 screen_data_cache::~screen_data_cache()
@@ -123,6 +613,32 @@ bool screen_data_cache::is_up_to_date() const
 	return result;
 }
 
+std::string screen_data_cache::settings_key(ScreenType type, const std::string &assembly, short trim_length, const std::string &transcript_selection,
+	Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd)
+{
+	std::stringstream ss;
+	ss << static_cast<int>(type)
+	   << '/' << assembly
+	   << '/' << trim_length
+	   << '/' << transcript_selection
+	   << '/' << zeep::value_serializer<Mode>::to_string(mode)
+	   << '/' << (cutOverlap ? "cut" : "no-cut")
+	   << '/' << geneStart
+	   << '/' << geneEnd;
+	return ss.str();
+}
+
+cache_info screen_data_cache::get_info() const
+{
+	cache_info result{ m_type, m_assembly, m_trim_length, m_transcript_selection, m_mode, m_cutOverlap, m_geneStart, m_geneEnd };
+
+	result.memory = memory_usage();
+	result.hits = m_hits;
+	result.idle = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_last_used).count();
+
+	return result;
+}
+
 // --------------------------------------------------------------------
 
 ip_screen_data_cache::ip_screen_data_cache(ScreenType type, const std::string &assembly,
@@ -132,83 +648,269 @@ ip_screen_data_cache::ip_screen_data_cache(ScreenType type, const std::string &a
 	, m_direction(direction)
 	, m_data(nullptr)
 {
-	auto screens = screen_service::instance().get_all_screens_for_type(type);
-	auto screenDataDir = screen_service::instance().get_screen_data_dir();
+}
 
-	uint32_t data_offset = 0;
-	size_t N = m_transcripts.size();
-	size_t M = screens.size();
+ip_screen_data_cache::ip_screen_data_cache(const ip_screen_data_cache &settings, Direction direction)
+	: screen_data_cache(settings)
+	, m_direction(direction)
+	, m_data(nullptr)
+{
+}
 
-	for (auto &screen : screens)
+std::vector<std::shared_ptr<ip_screen_data_cache>> ip_screen_data_cache::create(ScreenType type, const std::string &assembly,
+	short trim_length, const std::string &transcript_selection, Mode mode,
+	bool cutOverlap, const std::string &geneStart, const std::string &geneEnd, const std::vector<Direction> &directions)
+{
+	std::vector<std::shared_ptr<ip_screen_data_cache>> result;
+
+	for (auto direction : directions)
 	{
-		m_screens.push_back({ screen.name, false, screen.ignore, 0, data_offset });
-		data_offset += N;
+		if (result.empty())
+			result.emplace_back(new ip_screen_data_cache(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, direction));
+		else // shares the transcripts, no need to load them again
+			result.emplace_back(new ip_screen_data_cache(*result.front(), direction));
 	}
 
-	m_data = new data_point[N * M];
-	memset(m_data, 0, N * M * sizeof(data_point));
+	std::vector<ip_screen_data_cache *> caches;
+	for (auto &c : result)
+		caches.push_back(c.get());
 
-	// for (size_t si = 0; si < m_screens.size(); ++si)
-	for (auto &screen : m_screens)
+	fill(caches, std::vector<const ip_screen_data_cache *>(caches.size(), nullptr), {});
+
+	return result;
+}
+
+std::vector<std::shared_ptr<ip_screen_data_cache>> ip_screen_data_cache::update(const std::vector<std::shared_ptr<ip_screen_data_cache>> &base,
+	const std::set<std::string> &changed)
+{
+	std::vector<std::shared_ptr<ip_screen_data_cache>> result;
+	std::vector<ip_screen_data_cache *> caches;
+	std::vector<const ip_screen_data_cache *> bases;
+
+	for (auto &b : base)
 	{
-		try
-		{
-			fs::path screenDir = screenDataDir / screen.name;
-			auto data = IPPAScreenData::load(screenDir);
+		result.emplace_back(new ip_screen_data_cache(*b, b->m_direction));
+		caches.push_back(result.back().get());
+		bases.push_back(b.get());
+	}
 
-			auto d_data = m_data + screen.data_offset;
+	if (not caches.empty())
+		fill(caches, bases, changed);
 
-			auto cf = get_cache_file_path(screen.name);
-			if (fs::exists(cf) and fs::file_size(cf) == N * sizeof(data_point))
-			{
-				std::ifstream fcf(cf, std::ios::binary);
+	return result;
+}
 
-				fcf.read(reinterpret_cast<char *>(d_data), N * sizeof(data_point));
+void ip_screen_data_cache::fill(const std::vector<ip_screen_data_cache *> &caches, const std::vector<const ip_screen_data_cache *> &bases,
+	const std::set<std::string> &changed)
+{
+	assert(caches.size() == bases.size());
 
-				screen.filled = true;
-				continue;
-			}
+	auto &proto = *caches.front();
 
-			std::vector<Insertions> lowInsertions, highInsertions;
+	auto screens = screen_service::instance().get_all_screens_for_type(proto.m_type);
+	auto screenDataDir = screen_service::instance().get_screen_data_dir();
 
-			data->analyze(m_assembly, m_trim_length, m_transcripts, lowInsertions, highInsertions);
+	size_t N = proto.m_transcript_set->transcripts.size();
+	size_t M = screens.size();
 
-			auto dp = data->dataPoints(m_transcripts, lowInsertions, highInsertions, m_direction);
+	// the number of screens filled from the matrix file, if any
+	std::vector<size_t> loaded(caches.size(), 0);
 
-			for (size_t ti = 0; ti < N; ++ti)
-			{
-				auto &d = d_data[ti];
-				auto &p = dp[ti];
-
-				d.pv = p.pv;
-				d.fcpv = p.fcpv;
-				d.mi = p.mi;
-				d.low = p.low;
-				d.high = p.high;
-			}
+	proto.m_screens.clear();
 
-			screen.filled = true;
+	uint32_t data_offset = 0;
+	for (auto &screen : screens)
+	{
+		proto.m_screens.push_back({ screen.name, false, screen.ignore, 0, data_offset });
+		data_offset += N;
+	}
+
+	// all directions share the same input
+	proto.set_input_fingerprints(bases.front(), changed);
 
-			if (fs::exists(cf))
-				fs::remove(cf);
+	for (size_t ci = 0; ci < caches.size(); ++ci)
+	{
+		auto cache = caches[ci];
 
-			if (not fs::exists(cf.parent_path()))
-				fs::create_directories(cf.parent_path());
+		if (cache != &proto)
+			cache->m_screens = proto.m_screens;
 
-			std::ofstream fcf(cf, std::ios::binary);
+		std::optional<cache_block> block;
+		if (bases[ci] == nullptr)
+			block = cache->load_matrix(N * M * sizeof(data_point));
 
-			fcf.write(reinterpret_cast<char *>(d_data), N * sizeof(data_point));
+		if (block)
+		{
+			cache->m_block = std::move(*block);
+			loaded[ci] = std::count_if(cache->m_screens.begin(), cache->m_screens.end(), [](auto &s)
+				{ return s.filled; });
+		}
+		else
+			cache->m_block = cache_block(N * M * sizeof(data_point));
+
+		cache->m_data = reinterpret_cast<data_point *>(cache->m_block.data());
+	}
+
+	// Screens are processed in parallel, each worker writing straight into
+	// its own column of m_data of each of the caches. Reading insertions is
+	// I/O bound, only a few workers do that at the same time. The counting
+	// and statistics that follow are CPU bound.
+	semaphore io(kMaxConcurrentReads);
+
+	// building caches should not hold up requests for data already cached
+	scoped_priority priority(task_priority::batch);
+
+	parallel_for(M, [&](size_t si)
+		{
+		const std::string &name = proto.m_screens[si].name;
+
+		try
+		{
+			// the caches that still need data for this screen
+			std::vector<ip_screen_data_cache *> todo;
+
+			for (size_t ci = 0; ci < caches.size(); ++ci)
+			{
+				auto cache = caches[ci];
+				auto base = bases[ci];
+				auto &screen = cache->m_screens[si];
+
+				if (screen.filled)
+					continue;
+
+				if (changed.count(name))
+					fs::remove(cache->get_cache_file_path(name));
+				else if (base != nullptr)
+				{
+					// unchanged, take the column from the cache we're replacing
+					auto bi = std::find_if(base->m_screens.begin(), base->m_screens.end(), [&name](auto &bs)
+						{ return bs.name == name; });
+
+					if (bi != base->m_screens.end() and bi->filled)
+					{
+						std::copy(base->m_data + bi->data_offset, base->m_data + bi->data_offset + N, cache->m_data + screen.data_offset);
+						screen.filled = true;
+						continue;
+					}
+				}
+
+				todo.push_back(cache);
+			}
+
+			if (todo.empty())
+				return;
+
+			std::unique_ptr<IPPAScreenData> data;
+			std::shared_ptr<const screen_service::ip_insertion_index> index;
+			std::array<std::vector<Insertion>, 2> lowHigh;
+
+			{
+				semaphore_guard guard(io);
+
+				todo.erase(std::remove_if(todo.begin(), todo.end(), [&](ip_screen_data_cache *cache)
+					{
+						auto &screen = cache->m_screens[si];
+
+						if (not cache->read_cache_file(screen, { { cache->m_data + screen.data_offset, N * sizeof(data_point) } }))
+							return false;
+
+						screen.filled = true;
+						return true; }),
+					todo.end());
+
+				if (todo.empty())
+					return;
+
+				data = IPPAScreenData::load(screenDataDir / name);
+
+				index = screen_service::instance().find_insertion_index(name, proto.m_assembly, proto.m_trim_length);
+				if (not index)
+					lowHigh = data->read_low_high(proto.m_assembly, proto.m_trim_length);
+			}
+
+			if (not index)
+			{
+				index = std::make_shared<screen_service::ip_insertion_index>(
+					screen_service::ip_insertion_index{ InsertionIndex(lowHigh[0]), InsertionIndex(lowHigh[1]) });
+				lowHigh = {};
+
+				screen_service::instance().store_insertion_index(name, proto.m_assembly, proto.m_trim_length, index);
+			}
+
+			std::vector<InsertionTally> lowInsertions, highInsertions;
+
+			data->analyze(proto.m_transcript_set->table, *index, lowInsertions, highInsertions);
+
+			for (auto cache : todo)
+			{
+				auto &screen = cache->m_screens[si];
+				auto d_data = cache->m_data + screen.data_offset;
+
+				auto dp = data->dataPoints(proto.m_transcript_set->table, lowInsertions, highInsertions, cache->m_direction);
+
+				for (size_t ti = 0; ti < N; ++ti)
+				{
+					auto &d = d_data[ti];
+					auto &p = dp[ti];
+
+					d.pv = p.pv;
+					d.fcpv = p.fcpv;
+					d.mi = p.mi;
+					d.low = p.low;
+					d.high = p.high;
+				}
+
+				screen.filled = true;
+
+				cache->write_cache_file(screen, { { d_data, N * sizeof(data_point) } });
+			}
 		}
 		catch (const std::exception &ex)
 		{
 			std::cerr << ex.what() << std::endl;
-		}
+		} });
+
+	for (size_t ci = 0; ci < caches.size(); ++ci)
+	{
+		auto cache = caches[ci];
+
+		size_t filled = std::count_if(cache->m_screens.begin(), cache->m_screens.end(), [](auto &s)
+			{ return s.filled; });
+
+		cache->m_matrix_dirty = filled > loaded[ci];
+
+		cache->transpose();
 	}
+
+	report_fisher_cache();
+}
+
+void ip_screen_data_cache::transpose()
+{
+	size_t N = m_transcript_set->transcripts.size();
+	size_t M = m_screens.size();
+
+	m_gene_data.resize(N * M);
+
+	// blocks of genes, so reading a screen column is sequential while the
+	// gene rows being written stay in cache
+	const size_t kBlockSize = 64;
+
+	parallel_for((N + kBlockSize - 1) / kBlockSize, [&](size_t bi)
+		{
+		size_t b = bi * kBlockSize, e = std::min(b + kBlockSize, N);
+
+		for (size_t si = 0; si < M; ++si)
+		{
+			auto data = m_data + si * N;
+
+			for (size_t ti = b; ti < e; ++ti)
+				m_gene_data[ti * M + si] = { data[ti].fcpv, data[ti].mi, data[ti].low + data[ti].high };
+		} });
 }
 
 ip_screen_data_cache::~ip_screen_data_cache()
 {
-	delete[] m_data;
 }
 
 fs::path ip_screen_data_cache::get_cache_file_path(const std::string &screen_name) const
@@ -228,6 +930,26 @@ fs::path ip_screen_data_cache::get_cache_file_path(const std::string &screen_nam
 	return screen_service::instance().get_screen_data_dir() / screen_name / assembly / std::to_string(m_trim_length) / ss.str();
 }
 
+fs::path ip_screen_data_cache::get_matrix_file_path() const
+{
+	std::stringstream ss;
+	ss << zeep::value_serializer<ScreenType>::to_string(m_type)
+	   << '-' << m_assembly;
+
+	if (not(m_transcript_selection.empty() and m_transcript_selection != "default"))
+		ss << '-' << m_transcript_selection;
+
+	ss << '-' << m_trim_length
+	   << '-' << zeep::value_serializer<Mode>::to_string(m_mode)
+	   << '-' << (m_cutOverlap ? "cut" : "no-cut")
+	   << '-' << m_geneStart
+	   << '-' << m_geneEnd
+	   << '-' << zeep::value_serializer<Direction>::to_string(m_direction)
+	   << ".matrix";
+
+	return screen_service::instance().get_screen_data_dir() / ".caches" / ss.str();
+}
+
 std::vector<ip_data_point> ip_screen_data_cache::data_points(const std::string &screen)
 {
 	std::vector<ip_data_point> result;
@@ -238,7 +960,7 @@ std::vector<ip_data_point> ip_screen_data_cache::data_points(const std::string &
 		return {};
 
 	size_t screenIx = si - m_screens.begin();
-	size_t N = m_transcripts.size();
+	size_t N = m_transcript_set->transcripts.size();
 	auto data = m_data + screenIx * N;
 
 	auto &rank = gene_ranking::instance();
@@ -251,7 +973,7 @@ std::vector<ip_data_point> ip_screen_data_cache::data_points(const std::string &
 
 		ip_data_point p{};
 
-		p.gene = m_transcripts[i].geneName;
+		p.gene = m_transcript_set->transcripts[i].geneName;
 		p.pv = dp.pv;
 		p.fcpv = dp.fcpv;
 		p.mi = dp.mi;
@@ -276,7 +998,7 @@ std::vector<gene_uniqueness> ip_screen_data_cache::uniqueness(const std::string
 		return {};
 
 	size_t screenIx = si - m_screens.begin();
-	size_t N = m_transcripts.size();
+	size_t N = m_transcript_set->transcripts.size();
 	auto data = m_data + screenIx * N;
 
 	std::vector<gene_uniqueness> result;
@@ -286,6 +1008,8 @@ std::vector<gene_uniqueness> ip_screen_data_cache::uniqueness(const std::string
 		{ return not s.ignore; });
 	size_t minCount = screenCount, maxCount = 0;
 
+	size_t M = m_screens.size();
+
 	for (size_t ti = 0; ti < N; ++ti)
 	{
 		auto &dp = data[ti];
@@ -293,13 +1017,15 @@ std::vector<gene_uniqueness> ip_screen_data_cache::uniqueness(const std::string
 		if (dp.fcpv > pvCutOff)
 			continue;
 
+		auto gene_data = m_gene_data.data() + ti * M;
+
 		size_t geneCount = 0;
-		for (size_t si = 0; si < m_screens.size(); ++si)
+		for (size_t si = 0; si < M; ++si)
 		{
 			if (m_screens[si].ignore)
 				continue;
 
-			auto &sp = m_data[si * N + ti];
+			auto &sp = gene_data[si];
 
 			if (sp.fcpv > pvCutOff)
 				continue;
@@ -316,7 +1042,7 @@ std::vector<gene_uniqueness> ip_screen_data_cache::uniqueness(const std::string
 		if (maxCount < geneCount)
 			maxCount = geneCount;
 
-		result.push_back(gene_uniqueness{ m_transcripts[ti].geneName, 0, geneCount });
+		result.push_back(gene_uniqueness{ m_transcript_set->transcripts[ti].geneName, 0, geneCount });
 	}
 
 	double r = std::pow(maxCount - minCount, 0.001) - 1;
@@ -332,30 +1058,32 @@ std::vector<gene_uniqueness> ip_screen_data_cache::uniqueness(const std::string
 
 std::vector<ip_gene_finder_data_point> ip_screen_data_cache::find_gene(const std::string &gene, const std::set<std::string> &allowedScreens)
 {
-	auto gi = std::find_if(m_transcripts.begin(), m_transcripts.end(), [gene](auto &t)
+	auto gi = std::find_if(m_transcript_set->transcripts.begin(), m_transcript_set->transcripts.end(), [gene](auto &t)
 		{ return t.geneName == gene; });
-	if (gi == m_transcripts.end())
+	if (gi == m_transcript_set->transcripts.end())
 		return {};
 
-	size_t ti = gi - m_transcripts.begin();
-	size_t N = m_transcripts.size();
+	size_t ti = gi - m_transcript_set->transcripts.begin();
+	size_t M = m_screens.size();
+
+	auto gene_data = m_gene_data.data() + ti * M;
 
 	std::vector<ip_gene_finder_data_point> result;
 
-	for (size_t si = 0; si < m_screens.size(); ++si)
+	for (size_t si = 0; si < M; ++si)
 	{
-		const auto &[name, filled, ignore, ignore_2, ignore_3, ignore_4] = m_screens[si];
+		const auto &[name, filled, ignore, ignore_2, ignore_3, ignore_4, ignore_5] = m_screens[si];
 
 		if (filled and /*not ignore and*/ allowedScreens.count(name))
 		{
-			size_t ix = si * N + ti;
+			auto &d = gene_data[si];
 
 			ip_gene_finder_data_point p{};
 
 			p.screen = name;
-			p.fcpv = m_data[ix].fcpv;
-			p.mi = m_data[ix].mi;
-			p.insertions = m_data[ix].high + m_data[ix].low;
+			p.fcpv = d.fcpv;
+			p.mi = d.mi;
+			p.insertions = d.insertions;
 
 			result.push_back(std::move(p));
 		}
@@ -366,14 +1094,15 @@ std::vector<ip_gene_finder_data_point> ip_screen_data_cache::find_gene(const std
 
 std::vector<similar_data_point> ip_screen_data_cache::find_similar(const std::string &gene, float pvCutOff, float zscoreCutOff)
 {
-	size_t geneCount = m_transcripts.size(), screenCount = m_screens.size();
+	size_t geneCount = m_transcript_set->transcripts.size(), screenCount = m_screens.size();
 
-	auto gi = std::find_if(m_transcripts.begin(), m_transcripts.end(), [gene](auto &t)
+	auto gi = std::find_if(m_transcript_set->transcripts.begin(), m_transcript_set->transcripts.end(), [gene](auto &t)
 		{ return t.geneName == gene; });
-	if (gi == m_transcripts.end())
+	if (gi == m_transcript_set->transcripts.end())
 		return {};
 
-	size_t qg_ix = gi - m_transcripts.begin();
+	size_t qg_ix = gi - m_transcript_set->transcripts.begin();
+	auto q_data = m_gene_data.data() + qg_ix * screenCount;
 
 	std::vector<similar_data_point> result;
 
@@ -389,12 +1118,14 @@ std::vector<similar_data_point> ip_screen_data_cache::find_similar(const std::st
 			long double sum = 0;
 			bool data = false;
 
+			auto t_data = m_gene_data.data() + tg_ix * screenCount;
+
 			for (size_t s_ix = 0; s_ix < screenCount; ++s_ix)
 			{
 				float miQ, miT;
 
-				auto &a = m_data[s_ix * geneCount + tg_ix];
-				auto &b = m_data[s_ix * geneCount + qg_ix];
+				auto &a = t_data[s_ix];
+				auto &b = q_data[s_ix];
 
 				data = true;
 
@@ -412,7 +1143,7 @@ std::vector<similar_data_point> ip_screen_data_cache::find_similar(const std::st
 
 			double d = static_cast<double>(sqrt(sum));
 
-			hits.push_back(similar_data_point{ m_transcripts[tg_ix].geneName, static_cast<float>(d), 0.f, anti });
+			hits.push_back(similar_data_point{ m_transcript_set->transcripts[tg_ix].geneName, static_cast<float>(d), 0.f, anti });
 
 			distanceSum += d;
 		}
@@ -481,7 +1212,10 @@ class distance_map
 
 std::vector<cluster> ip_screen_data_cache::find_clusters(float pvCutOff, size_t minPts, float eps, size_t NNs)
 {
-	size_t geneCount = m_transcripts.size(), screenCount = m_screens.size(), dataCount = geneCount * screenCount;
+	// clustering takes long, let the other requests go first
+	scoped_priority priority(task_priority::batch);
+
+	size_t geneCount = m_transcript_set->transcripts.size(), screenCount = m_screens.size(), dataCount = geneCount * screenCount;
 
 	// std::vector<int> gene_detail_ids, screen_ids, geneIndex, screenIndex;
 	// tie(gene_detail_ids, screen_ids, geneIndex, screenIndex) = load_data(genomeID, pvCutOff);
@@ -493,7 +1227,7 @@ std::vector<cluster> ip_screen_data_cache::find_clusters(float pvCutOff, size_t
 	{
 		for (size_t s_ix = 0; s_ix < screenCount; ++s_ix)
 		{
-			auto &d = m_data[s_ix * geneCount + g_ix];
+			auto &d = m_gene_data[g_ix * screenCount + s_ix];
 			if (d.mi)
 				data[g_ix * screenCount + s_ix] = std::log2(d.mi);
 		}
@@ -788,7 +1522,7 @@ std::vector<cluster> ip_screen_data_cache::find_clusters(float pvCutOff, size_t
 		c.variance = std::get<1>(sc);
 
 		for (auto g : std::get<0>(sc))
-			c.genes.push_back(m_transcripts[g].geneName);
+			c.genes.push_back(m_transcript_set->table.geneName[g]);
 
 		if (not c.genes.empty())
 			result.push_back(std::move(c));
@@ -802,13 +1536,42 @@ std::vector<cluster> ip_screen_data_cache::find_clusters(float pvCutOff, size_t
 sl_screen_data_cache::sl_screen_data_cache(const std::string &assembly, short trim_length, const std::string &transcript_selection,
 	Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd)
 	: screen_data_cache(ScreenType::SyntheticLethal, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd)
+	, m_data(nullptr)
+	, m_replicate_data(nullptr)
+{
+	auto transcripts = m_transcript_set->transcripts;
+	prepare_transcripts(transcripts);
+	m_transcript_set = make_transcript_set(std::move(transcripts));
+
+	m_matrix_dirty = fill(nullptr, {});
+
+	transpose();
+	report_memory_usage();
+}
+
+sl_screen_data_cache::sl_screen_data_cache(const sl_screen_data_cache &base, const std::set<std::string> &changed)
+	: screen_data_cache(base)
+	, m_data(nullptr)
+	, m_replicate_data(nullptr)
+{
+	m_matrix_dirty = fill(&base, changed);
+
+	transpose();
+	report_memory_usage();
+}
+
+bool sl_screen_data_cache::fill(const sl_screen_data_cache *base, const std::set<std::string> &changed)
 {
+	scoped_priority priority(task_priority::batch);
+
 	auto screens = screen_service::instance().get_all_screens_for_type(m_type);
 	auto screenDataDir = screen_service::instance().get_screen_data_dir();
 
-	size_t N = m_transcripts.size();
+	m_screens.clear();
+
+	size_t N = m_transcript_set->transcripts.size();
 	size_t M = screens.size();
-	size_t O = 0;
+	size_t O = 0; // total number of replicates
 
 	uint32_t data_offset = 0;
 
@@ -817,128 +1580,311 @@ sl_screen_data_cache::sl_screen_data_cache(const std::string &assembly, short tr
 		m_screens.push_back({ screen.name, false, screen.ignore,
 			static_cast<uint8_t>(screen.files.size()),
 			data_offset,
-			static_cast<uint32_t>(O * M * N) });
+			static_cast<uint32_t>(O * N) });
 		data_offset += N;
 		O += screen.files.size();
 	}
 
-	m_data = new data_point[N * M];
-	memset(m_data, 0, N * M * sizeof(data_point));
+	// all screens are compared to the control, if that one was
+	// remapped everything has to be recalculated
+	std::string control = "ControlData-HAP1";
+	bool controlChanged = changed.count(control) > 0;
 
-	m_replicate_data = new data_point_replicate[N * M * O];
-	memset(m_replicate_data, 0, N * M * O * sizeof(data_point_replicate));
+	// the results depend on the control as well, include its fingerprint
+	uint64_t controlFingerprint = 0;
 
-	std::string control = "ControlData-HAP1";
-	auto controlDataPtr = SLScreenData::load(screenDataDir / control);
-	auto controlData = static_cast<SLScreenData *>(controlDataPtr.get());
+	try
+	{
+		controlFingerprint = ScreenData::load(screenDataDir / control, screen_service::instance().retrieve_screen(control))
+		                         ->input_fingerprint(m_assembly, m_trim_length);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not determine the input fingerprint for control " << control << ": " << ex.what() << std::endl;
+	}
 
-	filterOutExons(m_transcripts);
+	set_input_fingerprints(controlChanged ? nullptr : base, changed, controlFingerprint);
 
-	// reorder transcripts based on chr > end-position, makes code easier and faster
-	std::sort(m_transcripts.begin(), m_transcripts.end(), [](auto &a, auto &b)
-		{
-		int d = a.chrom - b.chrom;
-		if (d == 0)
-			d = a.start() - b.start();
-		return d < 0; });
+	static_assert(alignof(data_point) == alignof(data_point_replicate));
+
+	size_t blockSize = N * M * sizeof(data_point) + N * O * sizeof(data_point_replicate);
+
+	std::optional<cache_block> block;
+	if (base == nullptr)
+		block = load_matrix(blockSize);
+
+	m_block = block ? std::move(*block) : cache_block(blockSize);
+
+	m_data = reinterpret_cast<data_point *>(m_block.data());
+	m_replicate_data = reinterpret_cast<data_point_replicate *>(m_block.data() + N * M * sizeof(data_point));
+
+	// the matrix file needs to be written if anything was added to it
+	size_t loaded = std::count_if(m_screens.begin(), m_screens.end(), [](auto &s)
+		{ return s.filled; });
+
+	auto modified = [this, loaded]()
+	{
+		return static_cast<size_t>(std::count_if(m_screens.begin(), m_screens.end(), [](auto &s)
+			{ return s.filled; })) > loaded;
+	};
 
 	// #warning "make groupSize a parameter"
 	// unsigned groupSize = 500;
 	unsigned groupSize = 200;
 
-	auto normalizedControlInsertions = controlData->loadNormalizedInsertions(assembly, trim_length, m_transcripts, groupSize);
+	// First pass, take what we can from the cache we're replacing or from
+	// the cache files. What remains is calculated in the second pass.
+	std::vector<size_t> todo;
 
-	for (auto &screen : m_screens)
+	for (size_t si = 0; si < m_screens.size(); ++si)
 	{
-		if (VERBOSE)
-			std::cerr << "loading " << screen.name << std::endl;
+		auto &screen = m_screens[si];
+
+		if (screen.filled)
+			continue;
 
 		try
 		{
-			fs::path screenDir = screenDataDir / screen.name;
+			auto cd_data = m_data + screen.data_offset;
+			auto cr_data = m_replicate_data + screen.replicate_offset;
 
-			auto dataPtr = SLScreenData::load(screenDir);
-			auto data = static_cast<SLScreenData *>(dataPtr.get());
+			if (controlChanged or changed.count(screen.name))
+				fs::remove(get_cache_file_path(screen.name));
+			else if (base != nullptr)
+			{
+				// unchanged, take the columns from the cache we're replacing
+				auto bi = std::find_if(base->m_screens.begin(), base->m_screens.end(), [&screen](auto &bs)
+					{ return bs.name == screen.name; });
 
-			auto d_data = m_data + screen.data_offset;
+				if (bi != base->m_screens.end() and bi->filled and bi->file_count == screen.file_count)
+				{
+					auto b_data = base->m_data + bi->data_offset;
+					auto br_data = base->m_replicate_data + bi->replicate_offset;
 
-			data_point_replicate *r_data[4];
-			r_data[0] = m_replicate_data + screen.replicate_offset;
-			r_data[1] = r_data[0] + N;
-			r_data[2] = r_data[1] + N;
-			r_data[3] = r_data[2] + N;
+					std::copy(b_data, b_data + N, cd_data);
+					std::copy(br_data, br_data + N * screen.file_count, cr_data);
 
-			auto cd_data = d_data; // copy, for cache
-			auto cr_data = r_data[0];
+					screen.filled = true;
+					continue;
+				}
+			}
 
-			auto cf = get_cache_file_path(screen.name);
-			if (fs::exists(cf) and fs::file_size(cf) == N * sizeof(data_point) + N * screen.file_count * sizeof(data_point_replicate))
+			if (read_cache_file(screen, { { cd_data, N * sizeof(data_point) },
+											{ cr_data, N * screen.file_count * sizeof(data_point_replicate) } }))
 			{
-				std::ifstream fcf(cf, std::ios::binary);
+				if (VERBOSE)
+					std::cerr << "loading " << screen.name << " from cache" << std::endl;
+
+				screen.filled = true;
+				continue;
+			}
+
+			todo.push_back(si);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << ex.what() << std::endl;
+		}
+	}
 
-				fcf.read(reinterpret_cast<char *>(cd_data), N * sizeof(data_point));
-				fcf.read(reinterpret_cast<char *>(cr_data), N * screen.file_count * sizeof(data_point_replicate));
+	if (todo.empty())
+		return modified();
 
-				d_data += N;
+	// ----------------------------------------------------------------------
+	// Second pass, calculate the missing screens. The normalised control
+	// insertions are loaded up front, they're shared by all screens.
 
-				screen.filled = true;
+	std::array<std::vector<InsertionCount>, 4> normalizedControlInsertions;
+
+	try
+	{
+		auto controlDataPtr = SLScreenData::load(screenDataDir / control);
+		auto controlData = static_cast<SLScreenData *>(controlDataPtr.get());
+
+		normalizedControlInsertions = controlData->loadNormalizedInsertions(m_assembly, m_trim_length, m_transcript_set->table, groupSize);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not load control data: " << ex.what() << std::endl;
+		return modified();
+	}
+
+	// Each screen being built keeps all its replicates in memory, limit the
+	// number of screens built at once by the size of the largest one.
+	size_t maxScreenMemory = 0;
+
+	for (auto si : todo)
+	{
+		fs::path dir = screenDataDir / m_screens[si].name / m_assembly / std::to_string(m_trim_length);
+
+		std::error_code ec;
+		size_t screenMemory = 0;
+
+		for (auto &f : fs::directory_iterator(dir, ec))
+		{
+			// a replicate may be present both compressed and not, count the one in use
+			auto name = f.path().filename().string();
+			if (name.compare(0, 10, "replicate-") != 0 or (f.path().extension() != ".sq" and fs::exists(f.path().string() + ".sq")))
 				continue;
+
+			try
+			{
+				screenMemory += ScreenData::count_insertions(f.path()) * sizeof(Insertion);
+			}
+			catch (const std::exception &ex)
+			{
+				// will be reported when building this screen
 			}
+		}
 
-			// ----------------------------------------------------------------------
+		maxScreenMemory = std::max(maxScreenMemory, screenMemory);
+	}
+
+	size_t slots = maxScreenMemory > 0 ? screen_service::instance().get_sl_build_memory() / maxScreenMemory : todo.size();
+	slots = std::clamp<size_t>(slots, 1, std::min(todo.size(), thread_pool::instance().size()));
+
+	if (VERBOSE)
+		std::cerr << "building " << todo.size() << " screens, " << slots << " at a time" << std::endl;
+
+	// Screens are handed out to the slots one by one. Note that no lock
+	// may be held here, dataPoints uses the same pool and waiting threads
+	// help out with other tasks.
+	std::atomic<size_t> next = 0;
+
+	parallel_for(slots, [&](size_t)
+		{
+		for (;;)
+		{
+			size_t ti = next++;
+			if (ti >= todo.size())
+				break;
 
-			auto dp = data->dataPoints(assembly, trim_length, m_transcripts, normalizedControlInsertions, groupSize);
+			auto &screen = m_screens[todo[ti]];
 
-			for (size_t ti = 0; ti < N; ++ti)
+			try
 			{
-				auto &d = d_data[ti];
-				auto &p = dp[ti];
+				auto start = std::chrono::steady_clock::now();
 
-				d.odds_ratio = p.oddsRatio;
-				// d.sense_ratio = p.senseRatio;
-				// d.control_sense_ratio = p.controlSenseRatio;
-				d.control_binom = p.controlBinom;
-				// d.consistent = p.consistent;
+				auto d_data = m_data + screen.data_offset;
+				auto r_data = m_replicate_data + screen.replicate_offset;
 
-				for (size_t ri = 0; ri < p.replicates.size(); ++ri)
+				auto dataPtr = SLScreenData::load(screenDataDir / screen.name);
+				auto data = static_cast<SLScreenData *>(dataPtr.get());
+
+				// store the results directly into the matrix
+				data->dataPoints(m_assembly, m_trim_length, m_transcript_set->table, normalizedControlInsertions, groupSize,
+					[d_data, r_data, N, file_count = screen.file_count](size_t ti, const SLDataPoint &p)
+					{
+						auto &d = d_data[ti];
+
+						d.odds_ratio = p.oddsRatio;
+						d.control_binom = p.controlBinom;
+
+						for (size_t ri = 0; ri < p.replicates.size() and ri < file_count; ++ri)
+						{
+							auto &rp = p.replicates[ri];
+							auto &rd = r_data[ri * N + ti];
+
+							rd.sense = rp.sense_normalized;
+							rd.antisense = rp.antisense_normalized;
+							rd.pv[0] = rp.ref_pv[0];
+							rd.pv[1] = rp.ref_pv[1];
+							rd.pv[2] = rp.ref_pv[2];
+							rd.pv[3] = rp.ref_pv[3];
+							rd.binom_fdr = rp.binom_fdr;
+						} });
+
+				screen.filled = true;
+
+				write_cache_file(screen, { { d_data, N * sizeof(data_point) },
+											{ r_data, N * screen.file_count * sizeof(data_point_replicate) } });
+
+				if (VERBOSE)
 				{
-					auto &rp = p.replicates[ri];
-					auto &rd = r_data[ri][ti];
-
-					rd.sense = rp.sense_normalized;
-					rd.antisense = rp.antisense_normalized;
-					rd.pv[0] = rp.ref_pv[0];
-					rd.pv[1] = rp.ref_pv[1];
-					rd.pv[2] = rp.ref_pv[2];
-					rd.pv[3] = rp.ref_pv[3];
-					rd.binom_fdr = rp.binom_fdr;
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+					std::cerr << "built " << screen.name << " in " << std::fixed << std::setprecision(1) << elapsed.count() << "s" << std::endl;
 				}
 			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << screen.name << ": " << ex.what() << std::endl;
+			}
+		} });
 
-			screen.filled = true;
+	return modified();
+}
 
-			if (fs::exists(cf))
-				fs::remove(cf);
+void sl_screen_data_cache::transpose()
+{
+	size_t N = m_transcript_set->transcripts.size();
+	size_t M = m_screens.size();
+	size_t O = 0;
 
-			if (not fs::exists(cf.parent_path()))
-				fs::create_directories(cf.parent_path());
+	for (auto &screen : m_screens)
+		O += screen.file_count;
 
-			std::ofstream fcf(cf, std::ios::binary);
+	m_gene_odds_ratio.resize(N * M);
+	m_gene_replicate_data.resize(N * O);
 
-			fcf.write(reinterpret_cast<char *>(cd_data), N * sizeof(data_point));
-			fcf.write(reinterpret_cast<char *>(cr_data), N * screen.file_count * sizeof(data_point_replicate));
-		}
-		catch (const std::exception &ex)
+	if (N == 0)
+		return;
+
+	// blocks of genes, see ip_screen_data_cache::transpose
+	const size_t kBlockSize = 64;
+
+	parallel_for((N + kBlockSize - 1) / kBlockSize, [&](size_t bi)
 		{
-			std::cerr << ex.what() << std::endl;
-		}
-	};
+		size_t b = bi * kBlockSize, e = std::min(b + kBlockSize, N);
+
+		for (size_t si = 0; si < M; ++si)
+		{
+			auto &screen = m_screens[si];
+
+			auto d_data = m_data + screen.data_offset;
+			for (size_t ti = b; ti < e; ++ti)
+				m_gene_odds_ratio[ti * M + si] = d_data[ti].odds_ratio;
+
+			for (size_t ri = 0, r = screen.replicate_offset / N; ri < screen.file_count; ++ri, ++r)
+			{
+				auto r_data = m_replicate_data + screen.replicate_offset + ri * N;
+				for (size_t ti = b; ti < e; ++ti)
+					m_gene_replicate_data[ti * O + r] = { r_data[ti].sense, r_data[ti].antisense };
+			}
+		} });
 }
 
 sl_screen_data_cache::~sl_screen_data_cache()
 {
-	delete[] m_data;
-	delete[] m_replicate_data;
+}
+
+void sl_screen_data_cache::prepare_transcripts(std::vector<Transcript> &transcripts)
+{
+	filterOutExons(transcripts);
+
+	// reorder transcripts based on chr > end-position, makes code easier and faster
+	std::sort(transcripts.begin(), transcripts.end(), [](auto &a, auto &b)
+		{
+		int d = a.chrom - b.chrom;
+		if (d == 0)
+			d = a.start() - b.start();
+		return d < 0; });
+}
+
+void sl_screen_data_cache::report_memory_usage() const
+{
+	report_fisher_cache();
+
+	if (VERBOSE)
+	{
+		size_t replicates = 0;
+		for (auto &screen : m_screens)
+			replicates += screen.file_count;
+
+		std::cerr << "SL cache " << m_assembly << '/' << m_trim_length << ": "
+				  << m_transcript_set->transcripts.size() << " genes, " << m_screens.size() << " screens, "
+				  << replicates << " replicates, "
+				  << std::fixed << std::setprecision(1) << memory_usage() / (1024.0 * 1024) << " MB" << std::endl;
+	}
 }
 
 fs::path sl_screen_data_cache::get_cache_file_path(const std::string &screen_name) const
@@ -957,11 +1903,30 @@ fs::path sl_screen_data_cache::get_cache_file_path(const std::string &screen_nam
 	return screen_service::instance().get_screen_data_dir() / screen_name / assembly / std::to_string(m_trim_length) / ss.str();
 }
 
+fs::path sl_screen_data_cache::get_matrix_file_path() const
+{
+	std::stringstream ss;
+	ss << zeep::value_serializer<ScreenType>::to_string(m_type)
+	   << '-' << m_assembly;
+
+	if (not(m_transcript_selection.empty() and m_transcript_selection != "default"))
+		ss << '-' << m_transcript_selection;
+
+	ss << '-' << m_trim_length
+	   << '-' << zeep::value_serializer<Mode>::to_string(m_mode)
+	   << '-' << (m_cutOverlap ? "cut" : "no-cut")
+	   << '-' << m_geneStart
+	   << '-' << m_geneEnd
+	   << ".matrix";
+
+	return screen_service::instance().get_screen_data_dir() / ".caches" / ss.str();
+}
+
 std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &screen)
 {
 	std::vector<sl_data_point> result;
 
-	size_t N = m_transcripts.size();
+	size_t N = m_transcript_set->transcripts.size();
 
 	auto si = std::find_if(m_screens.begin(), m_screens.end(), [screen](auto &si)
 		{ return si.name == screen; });
@@ -972,11 +1937,8 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 	size_t screenIx = si - m_screens.begin();
 	auto d_data = m_data + m_screens[screenIx].data_offset;
 
-	data_point_replicate *r_data[4];
-	r_data[0] = m_replicate_data + m_screens[screenIx].replicate_offset;
-	r_data[1] = r_data[0] + N;
-	r_data[2] = r_data[1] + N;
-	r_data[3] = r_data[2] + N;
+	// replicate j of a screen is at replicate_offset + j * N
+	auto r_data = m_replicate_data + m_screens[screenIx].replicate_offset;
 
 	// reference/control data
 	std::string control = "ControlData-HAP1";
@@ -986,11 +1948,10 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 		throw std::runtime_error("Missing control data");
 	size_t controlScreenIx = si - m_screens.begin();
 
-	data_point_replicate *cr_data[4];
-	cr_data[0] = m_replicate_data + m_screens[controlScreenIx].replicate_offset;
-	cr_data[1] = cr_data[0] + N;
-	cr_data[2] = cr_data[1] + N;
-	cr_data[3] = cr_data[2] + N;
+	// the control has four replicates, but do not read past its data
+	size_t controlFileCount = std::min<size_t>(m_screens[controlScreenIx].file_count, 4);
+
+	auto cr_data = m_replicate_data + m_screens[controlScreenIx].replicate_offset;
 
 	for (size_t ti = 0; ti < N; ++ti)
 	{
@@ -1012,7 +1973,7 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 		{
 			sl_data_replicate rp{};
 
-			auto &nc = r_data[j][ti];
+			auto &nc = r_data[j * N + ti];
 
 			rp.sense = nc.sense;
 			rp.antisense = nc.antisense;
@@ -1031,9 +1992,9 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 			if (check == ConsistencyCheck::Inconsistent)
 				continue;
 
-			for (size_t k = 0; k < 4; ++k)
+			for (size_t k = 0; k < controlFileCount; ++k)
 			{
-				auto &ncc = cr_data[k][ti];
+				auto &ncc = cr_data[k * N + ti];
 
 				bool up = ((1.0f + nc.sense) / (2.0f + nc.sense + nc.antisense)) <
 				          ((1.0f + ncc.sense) / (2.0f + ncc.sense + ncc.antisense));
@@ -1063,13 +2024,13 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 
 		size_t s_wt = 0, a_wt = 0;
 
-		for (size_t j = 0; j < 4; ++j)
+		for (size_t j = 0; j < controlFileCount; ++j)
 		{
-			s_wt += cr_data[j][ti].sense;
-			a_wt += cr_data[j][ti].antisense;
+			s_wt += cr_data[j * N + ti].sense;
+			a_wt += cr_data[j * N + ti].antisense;
 		}
 
-		p.gene = m_transcripts[ti].geneName;
+		p.gene = m_transcript_set->transcripts[ti].geneName;
 		p.consistent = check != ConsistencyCheck::Inconsistent;
 		p.controlBinom = dp.control_binom;
 		p.oddsRatio = dp.odds_ratio;
@@ -1084,13 +2045,19 @@ std::vector<sl_data_point> sl_screen_data_cache::data_points(const std::string &
 
 std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std::string &gene, const std::set<std::string> &allowedScreens)
 {
-	auto gi = std::find_if(m_transcripts.begin(), m_transcripts.end(), [gene](auto &t)
+	auto gi = std::find_if(m_transcript_set->transcripts.begin(), m_transcript_set->transcripts.end(), [gene](auto &t)
 		{ return t.geneName == gene; });
-	if (gi == m_transcripts.end())
+	if (gi == m_transcript_set->transcripts.end())
 		return {};
 
-	size_t ti = gi - m_transcripts.begin();
-	size_t N = m_transcripts.size();
+	size_t ti = gi - m_transcript_set->transcripts.begin();
+	size_t N = m_transcript_set->transcripts.size();
+	size_t M = m_screens.size();
+	size_t O = N > 0 ? m_gene_replicate_data.size() / N : 0;
+
+	// the gene-major rows for this gene
+	auto g_odds_ratio = m_gene_odds_ratio.data() + ti * M;
+	auto g_replicates = m_gene_replicate_data.data() + ti * O;
 
 	std::vector<sl_gene_finder_data_point> result;
 
@@ -1102,27 +2069,19 @@ std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std
 		throw std::runtime_error("Missing control data");
 	size_t controlScreenIx = si - m_screens.begin();
 
-	data_point_replicate *cr_data[4];
-	cr_data[0] = m_replicate_data + m_screens[controlScreenIx].replicate_offset;
-	cr_data[1] = cr_data[0] + N;
-	cr_data[2] = cr_data[1] + N;
-	cr_data[3] = cr_data[2] + N;
+	// the control has four replicates, but do not read past its data
+	size_t controlFileCount = std::min<size_t>(m_screens[controlScreenIx].file_count, 4);
 
-	for (size_t si = 0; si < m_screens.size(); ++si)
+	auto cr_data = g_replicates + m_screens[controlScreenIx].replicate_offset / N;
+
+	for (size_t si = 0; si < M; ++si)
 	{
 		auto &screen = m_screens[si];
-		const auto &[name, filled, ignore, ignore_2, ignore_3, ignore_4] = screen;
+		const auto &[name, filled, ignore, ignore_2, ignore_3, ignore_4, ignore_5] = screen;
 
 		if (filled and /*not ignore and*/ allowedScreens.count(name))
 		{
-			auto d_data = m_data + screen.data_offset;
-			auto &dp = d_data[ti];
-
-			data_point_replicate *r_data[4];
-			r_data[0] = m_replicate_data + screen.replicate_offset;
-			r_data[1] = r_data[0] + N;
-			r_data[2] = r_data[1] + N;
-			r_data[3] = r_data[2] + N;
+			auto r_data = g_replicates + screen.replicate_offset / N;
 
 			sl_gene_finder_data_point p{};
 
@@ -1140,7 +2099,7 @@ std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std
 
 			for (size_t j = 0; j < screen.file_count; ++j)
 			{
-				auto &nc = r_data[j][ti];
+				auto &nc = r_data[j];
 
 				p.senseRatioPerReplicate.push_back((1.0f + nc.sense) / (2 + nc.sense + nc.antisense));
 
@@ -1151,9 +2110,9 @@ std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std
 				if (check == ConsistencyCheck::Inconsistent)
 					continue;
 
-				for (size_t k = 0; k < 4; ++k)
+				for (size_t k = 0; k < controlFileCount; ++k)
 				{
-					auto &ncc = cr_data[k][ti];
+					auto &ncc = cr_data[k];
 
 					bool up = ((1.0f + nc.sense) / (2.0f + nc.sense + nc.antisense)) <
 					          ((1.0f + ncc.sense) / (2.0f + ncc.sense + ncc.antisense));
@@ -1185,15 +2144,15 @@ std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std
 
 			// for (size_t j = 0; j < 4; ++j)
 			// {
-			// 	s_wt += cr_data[j][ti].sense;
-			// 	a_wt += cr_data[j][ti].antisense;
+			// 	s_wt += cr_data[j].sense;
+			// 	a_wt += cr_data[j].antisense;
 			// }
 
 			// p.controlBinom = dp.control_binom;
 			// p.controlSenseRatio = (1.0f + s_wt) / (2.0f + s_wt + a_wt);
 
 			p.senseRatio = (1.0f + s_g) / (2.0f + s_g + a_g);
-			p.oddsRatio = dp.odds_ratio;
+			p.oddsRatio = g_odds_ratio[si];
 			p.consistent = check != ConsistencyCheck::Inconsistent;
 
 			result.push_back(std::move(p));
@@ -1206,45 +2165,408 @@ std::vector<sl_gene_finder_data_point> sl_screen_data_cache::find_gene(const std
 // --------------------------------------------------------------------
 
 std::unique_ptr<screen_service> screen_service::s_instance;
+size_t screen_service::s_cache_memory_budget = 0;
+size_t screen_service::s_insertion_index_memory = 0;
+size_t screen_service::s_sl_build_memory = 4ULL << 30;
+std::vector<cache_settings> screen_service::s_warm_up;
 
-void screen_service::init(const std::string &screen_data_dir, const std::string &transcripts_dir)
+cache_settings cache_settings::parse(const std::string &s)
 {
-	assert(not s_instance);
-	s_instance.reset(new screen_service(screen_data_dir, transcripts_dir));
-}
+	std::vector<std::string> f;
 
-screen_service &screen_service::instance()
-{
-	assert(s_instance);
-	return *s_instance;
+	std::string::size_type b = 0;
+	for (;;)
+	{
+		auto e = s.find(':', b);
+		f.emplace_back(s.substr(b, e - b));
+		if (e == std::string::npos)
+			break;
+		b = e + 1;
+	}
+
+	if (f.size() != 7 or (f[4] != "cut" and f[4] != "no-cut"))
+		throw std::runtime_error("Invalid cache settings '" + s + "', expected type:assembly:transcripts:mode:cut|no-cut:gene-start:gene-end");
+
+	return {
+		zeep::value_serializer<ScreenType>::from_string(f[0]),
+		f[1], f[2],
+		zeep::value_serializer<Mode>::from_string(f[3]),
+		f[4] == "cut",
+		f[5], f[6]
+	};
 }
 
-screen_service::screen_service(const std::string &screen_data_dir, const std::string &transcipts_dir)
-	: m_screen_data_dir(screen_data_dir)
-	, m_transcripts_dir(transcipts_dir)
+// --------------------------------------------------------------------
+
+class warm_up_job : public job
+{
+  public:
+	warm_up_job(const std::vector<cache_settings> &settings)
+		: job("warm-up")
+		, m_settings(settings)
+	{
+	}
+
+	void execute() override
+	{
+		auto &service = screen_service::instance();
+
+		for (size_t i = 0; i < m_settings.size(); ++i)
+		{
+			auto &s = m_settings[i];
+
+			set_progress(static_cast<float>(i) / m_settings.size(), "warming up caches");
+
+			try
+			{
+				auto start = std::chrono::steady_clock::now();
+
+				// trim length is fixed at 50 in the web interface
+				if (s.type == ScreenType::SyntheticLethal)
+					service.get_screen_data(s.assembly, 50, s.transcript_selection, s.mode, s.cut_overlap, s.gene_start, s.gene_end);
+				else // builds the caches for all directions
+					service.get_screen_data(s.type, s.assembly, 50, s.transcript_selection, s.mode, s.cut_overlap, s.gene_start, s.gene_end, Direction::Both);
+
+				if (VERBOSE)
+				{
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+					std::cerr << "warmed up cache " << i + 1 << " of " << m_settings.size() << " in "
+							  << std::fixed << std::setprecision(1) << elapsed.count() << "s" << std::endl;
+				}
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Error warming up cache: " << ex.what() << std::endl;
+			}
+		}
+	}
+
+	void set_status(job_status_type status) override
+	{
+		job::set_status(status);
+
+		if (status == job_status_type::finished or status == job_status_type::failed)
+			screen_service::instance().set_ready();
+	}
+
+  private:
+	std::vector<cache_settings> m_settings;
+};
+
+// --------------------------------------------------------------------
+// Caches that have a matrix file, those were in use before the restart
+// and are quick to load. Loaded after the configured caches, most recently
+// written first and only as long as they fit in the memory budget.
+
+class matrix_warm_up_job : public job
+{
+  public:
+	struct candidate
+	{
+		cache_settings settings;
+		uint64_t transcripts_fingerprint;
+		size_t data_size;
+		std::vector<fs::path> files;
+	};
+
+	matrix_warm_up_job(std::vector<candidate> &&candidates)
+		: job("warm-up-matrices")
+		, m_candidates(std::move(candidates))
+	{
+	}
+
+	void execute() override
+	{
+		auto &service = screen_service::instance();
+
+		for (size_t i = 0; i < m_candidates.size(); ++i)
+		{
+			auto &c = m_candidates[i];
+			auto &s = c.settings;
+
+			set_progress(static_cast<float>(i) / m_candidates.size(), "loading cache matrices");
+
+			try
+			{
+				// the transcripts changed since this matrix was written, it
+				// would only be built from scratch
+				if (screen_data_cache::get_transcripts_fingerprint(s) != c.transcripts_fingerprint)
+				{
+					for (auto &file : c.files)
+						remove_matrix_file(file);
+					continue;
+				}
+
+				auto budget = service.get_cache_memory_budget();
+				if (budget > 0 and service.get_cache_memory() + c.data_size > budget)
+				{
+					if (VERBOSE)
+						std::cerr << "not loading cache matrix for " << c.files.front().filename() << ", memory budget exceeded" << std::endl;
+					continue;
+				}
+
+				if (s.type == ScreenType::SyntheticLethal)
+					service.get_screen_data(s.assembly, 50, s.transcript_selection, s.mode, s.cut_overlap, s.gene_start, s.gene_end);
+				else
+					service.get_screen_data(s.type, s.assembly, 50, s.transcript_selection, s.mode, s.cut_overlap, s.gene_start, s.gene_end, Direction::Both);
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Error loading cache matrix: " << ex.what() << std::endl;
+			}
+		}
+	}
+
+  private:
+	std::vector<candidate> m_candidates;
+};
+
+// --------------------------------------------------------------------
+
+class matrix_write_job : public job
+{
+  public:
+	matrix_write_job()
+		: job("write-matrices")
+	{
+	}
+
+	void execute() override
+	{
+		screen_service::instance().write_matrices();
+	}
+};
+
+void screen_service::schedule_matrix_writes()
+{
+	if (not m_matrix_writes_scheduled.exchange(true))
+		job_scheduler::instance().push(std::make_shared<matrix_write_job>());
+}
+
+void screen_service::write_matrices()
+{
+	// caches published after this point schedule a new job
+	m_matrix_writes_scheduled = false;
+
+	std::vector<std::shared_ptr<const screen_data_cache>> dirty;
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		for (auto &cache : m_ip_data_cache)
+		{
+			if (cache->is_matrix_dirty())
+			{
+				cache->clear_matrix_dirty();
+				dirty.push_back(cache);
+			}
+		}
+
+		for (auto &cache : m_sl_data_cache)
+		{
+			if (cache->is_matrix_dirty())
+			{
+				cache->clear_matrix_dirty();
+				dirty.push_back(cache);
+			}
+		}
+	}
+
+	for (auto &cache : dirty)
+		cache->write_matrix();
+}
+
+// --------------------------------------------------------------------
+
+void screen_service::init(const std::string &screen_data_dir, const std::string &transcripts_dir)
+{
+	assert(not s_instance);
+	s_instance.reset(new screen_service(screen_data_dir, transcripts_dir));
+
+	if (s_warm_up.empty())
+		s_instance->set_ready();
+	else
+		job_scheduler::instance().push(std::make_shared<warm_up_job>(s_warm_up));
+
+	// The other caches with a matrix file for the trim length used by the
+	// web interface, the directions of an IP/PA cache share their settings
+	std::map<std::string, matrix_warm_up_job::candidate> candidates;
+	std::map<std::string, fs::file_time_type> last_write;
+
+	for (auto &m : scan_matrix_files(s_instance->m_screen_data_dir / ".caches"))
+	{
+		if (m.header.algorithm_version != kCacheAlgorithmVersion)
+		{
+			remove_matrix_file(m.file);
+			continue;
+		}
+
+		if (m.header.trim_length != 50)
+			continue;
+
+		try
+		{
+			auto i = candidates.find(m.settings);
+			if (i == candidates.end())
+			{
+				auto settings = cache_settings::parse(m.settings);
+				if (std::find(s_warm_up.begin(), s_warm_up.end(), settings) != s_warm_up.end())
+					continue;
+
+				i = candidates.emplace(m.settings, matrix_warm_up_job::candidate{ settings, m.header.transcripts_fingerprint, 0 }).first;
+			}
+
+			i->second.data_size += m.header.data_size;
+			i->second.files.push_back(m.file);
+
+			if (last_write[m.settings] < m.last_write)
+				last_write[m.settings] = m.last_write;
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Could not read cache matrix " << m.file << ": " << ex.what() << std::endl;
+		}
+	}
+
+	if (candidates.empty())
+		return;
+
+	std::vector<std::pair<fs::file_time_type, std::string>> order;
+	for (auto &[settings, time] : last_write)
+		order.emplace_back(time, settings);
+	std::sort(order.rbegin(), order.rend());
+
+	std::vector<matrix_warm_up_job::candidate> todo;
+	for (auto &[time, settings] : order)
+		todo.push_back(std::move(candidates.at(settings)));
+
+	job_scheduler::instance().push(std::make_shared<matrix_warm_up_job>(std::move(todo)));
+}
+
+void screen_service::set_warm_up(const std::vector<cache_settings> &settings)
+{
+	s_warm_up = settings;
+}
+
+screen_service &screen_service::instance()
+{
+	assert(s_instance);
+	return *s_instance;
+}
+
+screen_service::screen_service(const std::string &screen_data_dir, const std::string &transcipts_dir)
+	: m_screen_data_dir(screen_data_dir)
+	, m_transcripts_dir(transcipts_dir)
 {
 	if (not fs::exists(m_screen_data_dir))
 		throw std::runtime_error("Screen data directory " + screen_data_dir + " does not exist");
+
+	// without a way to stop it, the watcher would outlive this object. In
+	// that case nothing is watched and the unwatched fallbacks are used.
+	m_stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (m_stop_fd < 0)
+		std::cerr << "Could not create event fd, not watching directories: " << strerror(errno) << std::endl;
+	else if (m_watch_fd = inotify_init1(IN_CLOEXEC); m_watch_fd < 0)
+		std::cerr << "Could not initialise inotify: " << strerror(errno) << std::endl;
+	else
+	{
+		m_screens_wd = inotify_add_watch(m_watch_fd, m_screen_data_dir.c_str(), IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR);
+		if (m_screens_wd < 0)
+			std::cerr << "Could not watch screen data directory " << m_screen_data_dir << ": " << strerror(errno) << std::endl;
+	}
+
+	load_registry();
+
+	if (fs::is_directory(m_transcripts_dir))
+	{
+		if (m_watch_fd >= 0)
+		{
+			m_transcripts_wd = inotify_add_watch(m_watch_fd, m_transcripts_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+			if (m_transcripts_wd < 0)
+				std::cerr << "Could not watch transcripts directory " << m_transcripts_dir << ": " << strerror(errno) << std::endl;
+		}
+
+		for (fs::directory_iterator di(m_transcripts_dir); di != fs::directory_iterator(); ++di)
+		{
+			if (di->path().extension() != ".tsv")
+				continue;
+
+			auto name = di->path().stem().string();
+
+			try
+			{
+				m_transcript_selections[name] = compile_transcript_selection(name);
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << "Could not load transcript selection " << name << ": " << e.what() << std::endl;
+			}
+		}
+	}
+
+	if (m_watch_fd >= 0)
+		m_watcher = std::thread(std::bind(&screen_service::watch_directories, this));
 }
 
-std::vector<screen_info> screen_service::get_all_screens() const
+screen_service::~screen_service()
 {
-	std::vector<screen_info> result;
+	if (m_watcher.joinable())
+	{
+		uint64_t v = 1;
+		if (write(m_stop_fd, &v, sizeof(v)) == sizeof(v))
+			m_watcher.join();
+		else
+			m_watcher.detach();
+	}
+
+	if (m_stop_fd >= 0)
+		close(m_stop_fd);
+
+	if (m_watch_fd >= 0)
+		close(m_watch_fd);
+}
+
+// --------------------------------------------------------------------
+
+std::shared_ptr<const screen_service::screen_registry> screen_service::get_registry() const
+{
+	std::unique_lock lock(m_registry_mutex);
+	return m_registry;
+}
+
+std::optional<screen_info> screen_service::find_screen(const std::string &name) const
+{
+	auto registry = get_registry();
+
+	auto i = registry->find(name);
+	if (i == registry->end())
+		return {};
+
+	return i->second;
+}
+
+void screen_service::load_registry()
+{
+	auto registry = std::make_shared<screen_registry>();
 
 	for (auto si : fs::directory_iterator(m_screen_data_dir))
 	{
-		if (not si.is_directory())
+		auto name = si.path().filename().string();
+
+		// hidden directories, like the one for the cache matrices, are no screens
+		if (not si.is_directory() or name.front() == '.')
 			continue;
 
+		// watch before reading, so no change can go unnoticed
+		watch_screen_dir(name);
+
 		std::error_code ec;
 		if (not fs::exists(si.path() / "manifest.json", ec))
 			continue;
 
 		try
 		{
-			auto screen = ScreenData::loadManifest(si.path());
-			screen.status = job_scheduler::instance().get_job_status_for_screen(screen.name);
-			result.push_back(screen);
+			registry->emplace(name, ScreenData::loadManifest(si.path()));
 		}
 		catch (const std::exception &e)
 		{
@@ -1252,6 +2574,79 @@ std::vector<screen_info> screen_service::get_all_screens() const
 		}
 	}
 
+	std::unique_lock lock(m_registry_mutex);
+	m_registry = registry;
+}
+
+void screen_service::watch_screen_dir(const std::string &name)
+{
+	if (m_watch_fd < 0)
+		return;
+
+	auto dir = m_screen_data_dir / name;
+
+	int wd = inotify_add_watch(m_watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR);
+	if (wd < 0)
+	{
+		std::cerr << "Could not watch screen directory " << dir << ": " << strerror(errno) << std::endl;
+		return;
+	}
+
+	std::unique_lock lock(m_registry_mutex);
+	m_screen_watches[wd] = name;
+}
+
+// Read the manifest for screen \a name again, or drop the screen if it
+// is gone. A copy of the registry is updated and then replaces the current.
+void screen_service::reload_screen(const std::string &name)
+{
+	auto dir = m_screen_data_dir / name;
+
+	std::optional<screen_info> info;
+	bool gone = false;
+
+	std::error_code ec;
+	if (not fs::exists(dir / "manifest.json", ec))
+		gone = true;
+	else
+	{
+		try
+		{
+			info = ScreenData::loadManifest(dir);
+		}
+		catch (const std::exception &e)
+		{
+			// keep what we had, the manifest may be written again shortly
+			std::cerr << "Could not load screen: " << name << ": " << e.what() << std::endl;
+			return;
+		}
+	}
+
+	std::unique_lock lock(m_registry_mutex);
+
+	auto registry = std::make_shared<screen_registry>(*m_registry);
+
+	if (gone)
+		registry->erase(name);
+	else
+		(*registry)[name] = *info;
+
+	m_registry = registry;
+}
+
+std::vector<screen_info> screen_service::get_all_screens() const
+{
+	auto registry = get_registry();
+
+	std::vector<screen_info> result;
+	result.reserve(registry->size());
+
+	for (auto &[name, info] : *registry)
+	{
+		result.push_back(info);
+		result.back().status = job_scheduler::instance().get_job_status_for_screen(name);
+	}
+
 	return result;
 }
 
@@ -1314,300 +2709,990 @@ std::set<std::string> screen_service::get_allowed_screens_for_user(const user &u
 {
 	std::set<std::string> result;
 
-	for (auto &si : fs::directory_iterator(m_screen_data_dir))
-	{
-		if (not si.is_directory())
-			continue;
+	auto registry = get_registry();
 
-		std::error_code ec;
-		if (not fs::exists(si.path() / "manifest.json", ec))
+	for (auto &[name, screen] : *registry)
+	{
+		if (screen.scientist == user.username or user.admin)
+		{
+			result.insert(screen.name);
 			continue;
+		}
 
-		try
+		for (auto &g : screen.groups)
 		{
-			auto screen = ScreenData::loadManifest(si.path());
-
-			if (screen.scientist == user.username or user.admin)
-			{
-				result.insert(screen.name);
+			if (std::find(user.groups.begin(), user.groups.end(), g) == user.groups.end())
 				continue;
-			}
-
-			for (auto &g : screen.groups)
-			{
-				if (std::find(user.groups.begin(), user.groups.end(), g) == user.groups.end())
-					continue;
 
-				result.insert(screen.name);
-				break;
-			}
-		}
-		catch (const std::exception &e)
-		{
-			std::cerr << "Could not load screen: " << si.path().filename() << ": " << e.what() << std::endl;
+			result.insert(screen.name);
+			break;
 		}
 	}
 
-	return result;
+	return result;
+}
+
+screen_info screen_service::retrieve_screen(const std::string &name) const
+{
+	auto screen = find_screen(name);
+
+	// not seen by the watcher yet, or not a screen at all
+	if (not screen)
+		return ScreenData::loadManifest(m_screen_data_dir / name);
+
+	return *screen;
+}
+
+bool screen_service::exists(const std::string &name) const noexcept
+{
+	if (find_screen(name))
+		return true;
+
+	std::error_code ec;
+	return fs::exists(m_screen_data_dir / name / "manifest.json", ec);
+}
+
+bool screen_service::is_valid_name(const std::string &name)
+{
+	const std::regex rx(R"([\n\r\t :<>|&])");
+	return not std::regex_search(name.begin(), name.end(), rx);
+}
+
+bool screen_service::is_owner(const std::string &name, const std::string &username) const
+{
+	bool result = false;
+
+	try
+	{
+		auto manifest = retrieve_screen(name);
+		result = manifest.scientist == username;
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
+
+	return result;
+}
+
+bool screen_service::is_allowed(const std::string &screenname, const std::string &username) const
+{
+	bool result = false;
+
+	try
+	{
+		auto manifest = retrieve_screen(screenname);
+
+		if (manifest.scientist == username)
+			result = true;
+		else
+			result = std::find(manifest.groups.begin(), manifest.groups.end(), "public") != manifest.groups.end();
+
+		if (not result)
+		{
+			auto user = user_service::instance().retrieve_user(username);
+			if (user.admin)
+				result = true;
+			else
+			{
+				for (auto &g : manifest.groups)
+				{
+					if (std::find(user.groups.begin(), user.groups.end(), g) == user.groups.end())
+						continue;
+
+					result = true;
+					break;
+				}
+			}
+		}
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+		result = false;
+	}
+
+	return result;
+}
+
+screen_description screen_service::get_description(const std::string &name, const std::string &assembly, short trim_length) const
+{
+	auto manifest = retrieve_screen(name);
+
+	screen_description result;
+	result.description = manifest.description.value_or(name);
+	if (result.description.empty())
+		result.description = name;
+
+	for (auto &mi : manifest.mappedInfo)
+	{
+		if (mi.assembly != assembly or mi.trimlength != static_cast<unsigned>(trim_length))
+			continue;
+		
+		for (auto file : mi.file)
+			result.counts.emplace_back(file);
+	}
+
+	return result;
+}
+
+uint32_t screen_service::count_insertions(const std::string &name, const std::string &assembly, short trim_length, const std::string &file) const
+{
+	return ScreenData::count_insertions(m_screen_data_dir / name / assembly / std::to_string(trim_length) / file);
+}
+
+std::unique_ptr<ScreenData> screen_service::create_screen(const screen_info &screen)
+{
+	auto screenDir = m_screen_data_dir / screen.name;
+
+	std::unique_ptr<ScreenData> data;
+
+	switch (screen.type)
+	{
+		case ScreenType::IntracellularPhenotype:
+		{
+			data = std::make_unique<IPScreenData>(screenDir, screen);
+			break;
+		}
+
+		case ScreenType::IntracellularPhenotypeActivation:
+		{
+			data = std::make_unique<PAScreenData>(screenDir, screen);
+			break;
+		}
+
+		case ScreenType::SyntheticLethal:
+		{
+			data = std::make_unique<SLScreenData>(screenDir, screen);
+			break;
+		}
+
+		case ScreenType::Unspecified:
+			throw std::runtime_error("Unknown screen type");
+			break;
+	}
+
+	// the watcher picks this up as well, but don't make the caller wait for that
+	watch_screen_dir(screen.name);
+	reload_screen(screen.name);
+
+	return data;
+}
+
+void screen_service::update_screen(const std::string &name, const screen_info &screen)
+{
+	ScreenData::saveManifest(screen, m_screen_data_dir / name);
+	reload_screen(name);
+}
+
+void screen_service::delete_screen(const std::string &name)
+{
+	fs::remove_all(m_screen_data_dir / name);
+	reload_screen(name);
+}
+
+void screen_service::refresh_manifest(const std::string &name)
+{
+	auto d = m_screen_data_dir / name;
+	auto info = ScreenData::loadManifest(d);
+	ScreenData::refreshManifest(info, d);
+	reload_screen(name);
+}
+
+void screen_service::refresh_manifest_all()
+{
+	auto registry = get_registry();
+
+	for (auto &[name, info] : *registry)
+	{
+		try
+		{
+			refresh_manifest(name);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "Could not load screen: " << name << ": " << e.what() << std::endl;
+		}
+	}
+}
+
+namespace
+{
+
+std::vector<std::shared_ptr<ip_screen_data_cache>> update_caches(const std::vector<std::shared_ptr<ip_screen_data_cache>> &caches,
+	const std::set<std::string> &changed)
+{
+	return ip_screen_data_cache::update(caches, changed);
+}
+
+std::vector<std::shared_ptr<sl_screen_data_cache>> update_caches(const std::vector<std::shared_ptr<sl_screen_data_cache>> &caches,
+	const std::set<std::string> &changed)
+{
+	std::vector<std::shared_ptr<sl_screen_data_cache>> result;
+	for (auto &cache : caches)
+		result.emplace_back(std::make_shared<sl_screen_data_cache>(*cache, changed));
+	return result;
+}
+
+} // namespace
+
+// Run the build registered as \a key in \a builds, this is done without
+// holding m_mutex. When done the caches in \a replaced are replaced with
+// the result. Screens mapped in the mean time are recalculated first.
+template <typename Cache, typename Build>
+std::vector<std::shared_ptr<Cache>> screen_service::run_build(const std::string &key, std::promise<std::vector<std::shared_ptr<Cache>>> &promise,
+	std::map<std::string, cache_build<Cache>> &builds, std::list<std::shared_ptr<Cache>> &caches,
+	const std::vector<std::shared_ptr<Cache>> &replaced, Build &&build)
+{
+	std::shared_ptr<priority_boost> boost;
+
+	{
+		std::unique_lock lock(m_mutex);
+		boost = builds.at(key).boost;
+	}
+
+	// a build started by a background job, like the warm-up, is raised to
+	// the priority of the most urgent request waiting for it
+	scoped_priority priority(boost);
+
+	try
+	{
+		auto result = build();
+
+		for (;;)
+		{
+			std::set<std::string> changed;
+
+			{
+				std::unique_lock lock(m_mutex);
+
+				auto &b = builds.at(key);
+
+				if (b.changed.empty())
+				{
+					for (auto &cache : replaced)
+						caches.remove(cache);
+
+					if (not b.discard)
+					{
+						for (auto &cache : result)
+						{
+							cache->record_use();
+							if (cache->is_matrix_dirty())
+								schedule_matrix_writes();
+						}
+
+						caches.insert(caches.end(), result.begin(), result.end());
+					}
+
+					builds.erase(key);
+
+					evict_caches();
+					break;
+				}
+
+				std::swap(changed, b.changed);
+			}
+
+			result = update_caches(result, changed);
+		}
+
+		promise.set_value(result);
+		return result;
+	}
+	catch (...)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			builds.erase(key);
+		}
+
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+}
+
+void screen_service::set_cache_memory_budget(size_t bytes)
+{
+	s_cache_memory_budget = bytes;
+}
+
+void screen_service::set_insertion_index_memory(size_t bytes)
+{
+	s_insertion_index_memory = bytes;
+}
+
+void screen_service::set_sl_build_memory(size_t bytes)
+{
+	s_sl_build_memory = bytes;
+}
+
+size_t screen_service::get_sl_build_memory()
+{
+	size_t result = s_sl_build_memory;
+
+	if (s_cache_memory_budget > 0)
+	{
+		std::unique_lock lock(m_index_mutex);
+
+		size_t used = m_cache_memory + m_insertion_index_memory;
+		result = std::min(result, used < s_cache_memory_budget ? s_cache_memory_budget - used : 0);
+	}
+
+	return result;
+}
+
+// Drop the least recently used caches until the memory budget is met,
+// m_mutex should be held. Caches differing only in direction go together.
+// The most recently used set is always kept. Dropped caches are rebuilt
+// from the per-screen cache files when needed again. The insertion
+// indices get what is left of the budget.
+void screen_service::evict_caches()
+{
+	for (;;)
+	{
+		size_t total = 0;
+		std::map<std::string, std::chrono::steady_clock::time_point> last_used;
+
+		auto add = [&](const screen_data_cache &cache)
+		{
+			total += cache.memory_usage();
+
+			auto &lu = last_used[cache.settings_key()];
+			lu = std::max(lu, cache.get_last_used());
+		};
+
+		for (auto &cache : m_ip_data_cache)
+			add(*cache);
+		for (auto &cache : m_sl_data_cache)
+			add(*cache);
+
+		m_cache_memory = total;
+
+		if (s_cache_memory_budget == 0 or total <= s_cache_memory_budget or last_used.size() <= 1)
+			break;
+
+		auto victim = std::min_element(last_used.begin(), last_used.end(), [](auto &a, auto &b)
+			{ return a.second < b.second; })->first;
+
+		if (VERBOSE)
+			std::cerr << "Cache memory " << (total >> 20) << " MB exceeds budget, dropping cache " << victim << std::endl;
+
+		auto is_victim = [&victim](auto &cache)
+		{
+			return cache->settings_key() == victim;
+		};
+
+		m_ip_data_cache.remove_if(is_victim);
+		m_sl_data_cache.remove_if(is_victim);
+	}
+
+	std::unique_lock lock(m_index_mutex);
+	trim_insertion_indices(0);
+}
+
+std::vector<cache_info> screen_service::get_cache_info()
+{
+	std::unique_lock lock(m_mutex);
+
+	std::vector<cache_info> result;
+
+	for (auto &cache : m_ip_data_cache)
+		result.push_back(cache->get_info());
+	for (auto &cache : m_sl_data_cache)
+		result.push_back(cache->get_info());
+
+	return result;
+}
+
+std::shared_ptr<ip_screen_data_cache> screen_service::get_screen_data(const ScreenType type, const std::string &assembly, short trim_length,
+	const std::string &transcript_selection, Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd, Direction direction)
+{
+	auto key = screen_data_cache::settings_key(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd);
+
+	std::promise<std::vector<std::shared_ptr<ip_screen_data_cache>>> promise;
+	std::shared_future<std::vector<std::shared_ptr<ip_screen_data_cache>>> future;
+	bool owner = false;
+
+	// The caches for the other directions share all of the work except
+	// for the statistics, so they're created and updated together.
+
+	std::vector<std::shared_ptr<ip_screen_data_cache>> siblings;
+	std::vector<Direction> missing{ Direction::Sense, Direction::AntiSense, Direction::Both };
+	bool stale = false;
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		auto i = std::find_if(m_ip_data_cache.begin(), m_ip_data_cache.end(),
+			std::bind(&ip_screen_data_cache::is_for, std::placeholders::_1, type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, direction));
+
+		if (i != m_ip_data_cache.end() and (*i)->is_up_to_date())
+		{
+			(*i)->record_use();
+			return *i;
+		}
+
+		auto b = m_ip_builds.find(key);
+		if (b != m_ip_builds.end())
+		{
+			future = b->second.result;
+			b->second.boost->raise(current_priority());
+		}
+		else
+		{
+			owner = true;
+			future = promise.get_future().share();
+			m_ip_builds.emplace(key, cache_build<ip_screen_data_cache>{ future, type, transcript_selection });
+
+			for (auto &cache : m_ip_data_cache)
+			{
+				if (not cache->screen_data_cache::is_for(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd))
+					continue;
+
+				siblings.push_back(cache);
+				missing.erase(std::remove(missing.begin(), missing.end(), cache->get_direction()), missing.end());
+			}
+
+			stale = i != m_ip_data_cache.end();
+		}
+	}
+
+	if (owner)
+	{
+		run_build(key, promise, m_ip_builds, m_ip_data_cache, siblings, [&]()
+			{
+			// when screens were added or removed, keep the columns we already have
+			if (stale)
+				return ip_screen_data_cache::update(siblings, {});
+
+			auto result = ip_screen_data_cache::create(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, missing);
+			result.insert(result.end(), siblings.begin(), siblings.end());
+			return result; });
+	}
+
+	for (auto &cache : future.get())
+	{
+		if (cache->get_direction() == direction)
+			return cache;
+	}
+
+	// The build we waited for did not include this direction
+	return get_screen_data(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, direction);
+}
+
+std::shared_ptr<sl_screen_data_cache> screen_service::get_screen_data(const std::string &assembly, short trim_length,
+	const std::string &transcript_selection, Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd)
+{
+	auto key = screen_data_cache::settings_key(ScreenType::SyntheticLethal, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd);
+
+	std::promise<std::vector<std::shared_ptr<sl_screen_data_cache>>> promise;
+	std::shared_future<std::vector<std::shared_ptr<sl_screen_data_cache>>> future;
+	bool owner = false;
+
+	std::vector<std::shared_ptr<sl_screen_data_cache>> replaced;
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		auto i = std::find_if(m_sl_data_cache.begin(), m_sl_data_cache.end(),
+			std::bind(&sl_screen_data_cache::is_for, std::placeholders::_1, ScreenType::SyntheticLethal, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd));
+
+		if (i != m_sl_data_cache.end() and (*i)->is_up_to_date())
+		{
+			(*i)->record_use();
+			return *i;
+		}
+
+		auto b = m_sl_builds.find(key);
+		if (b != m_sl_builds.end())
+		{
+			future = b->second.result;
+			b->second.boost->raise(current_priority());
+		}
+		else
+		{
+			owner = true;
+			future = promise.get_future().share();
+			m_sl_builds.emplace(key, cache_build<sl_screen_data_cache>{ future, ScreenType::SyntheticLethal, transcript_selection });
+
+			if (i != m_sl_data_cache.end())
+				replaced.push_back(*i);
+		}
+	}
+
+	if (owner)
+	{
+		run_build(key, promise, m_sl_builds, m_sl_data_cache, replaced, [&]()
+			{
+			// when screens were added or removed, keep the columns we already have
+			if (not replaced.empty())
+				return update_caches(replaced, {});
+
+			return std::vector<std::shared_ptr<sl_screen_data_cache>>{
+				std::make_shared<sl_screen_data_cache>(assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd) }; });
+	}
+
+	return future.get().front();
+}
+
+void screen_service::screen_mapped(const std::unique_ptr<ScreenData> &screen)
+{
+	// Replace the affected caches with a copy in which only the column for
+	// this screen is recalculated. Requests still holding the old cache
+	// keep on using it until they're done, and requests coming in while
+	// updating still get the old one.
+
+	std::set<std::string> changed{ screen->name() };
+
+	{
+		std::unique_lock index_lock(m_index_mutex);
+
+		for (auto i = m_insertion_indices.begin(); i != m_insertion_indices.end();)
+		{
+			if (i->screen == screen->name())
+			{
+				m_insertion_index_memory -= i->size;
+				i = m_insertion_indices.erase(i);
+			}
+			else
+				++i;
+		}
+	}
+
+	struct ip_update
+	{
+		std::string key;
+		std::vector<std::shared_ptr<ip_screen_data_cache>> group;
+		std::promise<std::vector<std::shared_ptr<ip_screen_data_cache>>> promise;
+	};
+
+	struct sl_update
+	{
+		std::string key;
+		std::shared_ptr<sl_screen_data_cache> cache;
+		std::promise<std::vector<std::shared_ptr<sl_screen_data_cache>>> promise;
+	};
+
+	std::list<ip_update> ip_updates;
+	std::list<sl_update> sl_updates;
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		// builds in flight pick up this screen when they're done
+		for (auto &[key, build] : m_ip_builds)
+		{
+			if (build.type == screen->get_type())
+				build.changed.insert(screen->name());
+		}
+
+		for (auto &[key, build] : m_sl_builds)
+		{
+			if (build.type == screen->get_type())
+				build.changed.insert(screen->name());
+		}
+
+		// the caches differing only in direction are updated in one go
+		std::map<std::string, std::vector<std::shared_ptr<ip_screen_data_cache>>> groups;
+
+		for (auto &cache : m_ip_data_cache)
+		{
+			if (cache->contains_data_for_screen(screen->name()) or cache->get_type() == screen->get_type())
+				groups[cache->settings_key()].push_back(cache);
+		}
+
+		for (auto &[key, group] : groups)
+		{
+			if (m_ip_builds.count(key))
+				continue;
+
+			auto &u = ip_updates.emplace_back(ip_update{ key, std::move(group) });
+			m_ip_builds.emplace(key, cache_build<ip_screen_data_cache>{ u.promise.get_future().share(), u.group.front()->get_type(), u.group.front()->get_transcript_selection() });
+		}
+
+		for (auto &cache : m_sl_data_cache)
+		{
+			if (not (cache->contains_data_for_screen(screen->name()) or cache->get_type() == screen->get_type()))
+				continue;
+
+			auto key = cache->settings_key();
+			if (m_sl_builds.count(key))
+				continue;
+
+			auto &u = sl_updates.emplace_back(sl_update{ key, cache });
+			m_sl_builds.emplace(key, cache_build<sl_screen_data_cache>{ u.promise.get_future().share(), cache->get_type(), cache->get_transcript_selection() });
+		}
+	}
+
+	// every registered build must be run, or requests waiting for it would hang
+
+	for (auto &u : ip_updates)
+	{
+		try
+		{
+			run_build(u.key, u.promise, m_ip_builds, m_ip_data_cache, u.group, [&]()
+				{ return update_caches(u.group, changed); });
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error updating cache " << u.key << ": " << ex.what() << std::endl;
+		}
+	}
+
+	for (auto &u : sl_updates)
+	{
+		try
+		{
+			run_build(u.key, u.promise, m_sl_builds, m_sl_data_cache, { u.cache }, [&]()
+				{ return update_caches({ u.cache }, changed); });
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error updating cache " << u.key << ": " << ex.what() << std::endl;
+		}
+	}
+}
+
+std::shared_ptr<const screen_service::ip_insertion_index> screen_service::find_insertion_index(const std::string &screen,
+	const std::string &assembly, short trim_length)
+{
+	std::unique_lock lock(m_index_mutex);
+
+	auto i = std::find_if(m_insertion_indices.begin(), m_insertion_indices.end(), [&](auto &e)
+		{ return e.screen == screen and e.assembly == assembly and e.trim_length == trim_length; });
+
+	if (i == m_insertion_indices.end())
+		return {};
+
+	m_insertion_indices.splice(m_insertion_indices.begin(), m_insertion_indices, i);
+	return i->index;
+}
+
+void screen_service::store_insertion_index(const std::string &screen, const std::string &assembly, short trim_length,
+	std::shared_ptr<const ip_insertion_index> index)
+{
+	size_t size = (*index)[0].memory_usage() + (*index)[1].memory_usage();
+
+	std::unique_lock lock(m_index_mutex);
+
+	auto i = std::find_if(m_insertion_indices.begin(), m_insertion_indices.end(), [&](auto &e)
+		{ return e.screen == screen and e.assembly == assembly and e.trim_length == trim_length; });
+
+	if (i != m_insertion_indices.end())
+	{
+		m_insertion_index_memory -= i->size;
+		m_insertion_indices.erase(i);
+	}
+
+	m_insertion_indices.push_front({ screen, assembly, trim_length, index, size });
+	m_insertion_index_memory += size;
+
+	// never evict the one just added
+	trim_insertion_indices(1);
 }
 
-screen_info screen_service::retrieve_screen(const std::string &name) const
+size_t screen_service::get_insertion_index_limit() const
 {
-	return ScreenData::loadManifest(m_screen_data_dir / name);
+	size_t result = s_insertion_index_memory > 0 ? s_insertion_index_memory : std::numeric_limits<size_t>::max();
+
+	if (s_cache_memory_budget > 0)
+		result = std::min(result, m_cache_memory < s_cache_memory_budget ? s_cache_memory_budget - m_cache_memory : 0);
+
+	return result;
 }
 
-bool screen_service::exists(const std::string &name) const noexcept
+// Drop the least recently used indices, keeping at least \a keep
+void screen_service::trim_insertion_indices(size_t keep)
 {
-	std::error_code ec;
-	return fs::exists(m_screen_data_dir / name / "manifest.json", ec);
+	auto limit = get_insertion_index_limit();
+
+	while (m_insertion_index_memory > limit and m_insertion_indices.size() > keep)
+	{
+		m_insertion_index_memory -= m_insertion_indices.back().size;
+		m_insertion_indices.pop_back();
+	}
 }
 
-bool screen_service::is_valid_name(const std::string &name)
+std::tuple<size_t, size_t> screen_service::get_insertion_index_usage()
 {
-	const std::regex rx(R"([\n\r\t :<>|&])");
-	return not std::regex_search(name.begin(), name.end(), rx);
+	std::unique_lock lock(m_index_mutex);
+	return { m_insertion_indices.size(), m_insertion_index_memory };
 }
 
-bool screen_service::is_owner(const std::string &name, const std::string &username) const
+std::vector<std::string> screen_service::get_all_transcripts() const
 {
-	bool result = false;
+	std::vector<std::string> result;
 
-	try
+	if (m_watch_fd >= 0)
 	{
-		auto manifest = ScreenData::loadManifest(m_screen_data_dir / name);
-		result = manifest.scientist == username;
+		std::unique_lock lock(m_transcripts_mutex);
+		for (auto &[name, selection] : m_transcript_selections)
+			result.push_back(name);
 	}
-	catch (const std::exception &ex)
+	else if (fs::is_directory(m_transcripts_dir))
 	{
-		std::cerr << ex.what() << std::endl;
+		for (fs::directory_iterator di(m_transcripts_dir); di != fs::directory_iterator(); ++di)
+			result.push_back(di->path().filename().stem().string());
 	}
 
 	return result;
 }
 
-bool screen_service::is_allowed(const std::string &screenname, const std::string &username) const
+std::shared_ptr<const std::vector<Transcript>> screen_service::load_transcript_selection(const std::string &name)
 {
-	bool result = false;
+	// without a watcher we cannot tell whether a selection changed
+	if (m_watch_fd < 0)
+		return compile_transcript_selection(name);
 
-	try
-	{
-		auto manifest = ScreenData::loadManifest(m_screen_data_dir / screenname);
-
-		if (manifest.scientist == username)
-			result = true;
-		else
-			result = std::find(manifest.groups.begin(), manifest.groups.end(), "public") != manifest.groups.end();
-
-		if (not result)
-		{
-			auto user = user_service::instance().retrieve_user(username);
-			if (user.admin)
-				result = true;
-			else
-			{
-				for (auto &g : manifest.groups)
-				{
-					if (std::find(user.groups.begin(), user.groups.end(), g) == user.groups.end())
-						continue;
+	std::unique_lock lock(m_transcripts_mutex);
 
-					result = true;
-					break;
-				}
-			}
-		}
-	}
-	catch (const std::exception &ex)
-	{
-		std::cerr << ex.what() << std::endl;
-		result = false;
-	}
+	auto i = m_transcript_selections.find(name);
+	if (i == m_transcript_selections.end())
+		i = m_transcript_selections.emplace(name, compile_transcript_selection(name)).first;
 
-	return result;
+	return i->second;
 }
 
-screen_description screen_service::get_description(const std::string &name, const std::string &assembly, short trim_length) const
+std::shared_ptr<const std::vector<Transcript>> screen_service::compile_transcript_selection(const std::string &name) const
 {
-	auto manifest = ScreenData::loadManifest(m_screen_data_dir / name);
+	std::ifstream in(m_transcripts_dir / (name + ".tsv"));
+	if (not in.is_open())
+		throw std::runtime_error("Could not open transcript selection " + name);
 
-	screen_description result;
-	result.description = manifest.description.value_or(name);
-	if (result.description.empty())
-		result.description = name;
+	auto result = std::make_shared<const std::vector<Transcript>>(loadGenes(in, false, false));
 
-	for (auto &mi : manifest.mappedInfo)
-	{
-		if (mi.assembly != assembly or mi.trimlength != static_cast<unsigned>(trim_length))
-			continue;
-		
-		for (auto file : mi.file)
-			result.counts.emplace_back(file);
-	}
+	if (VERBOSE)
+		std::cerr << "Compiled transcript selection " << name << " with " << result->size() << " transcripts" << std::endl;
 
 	return result;
 }
 
-uint32_t screen_service::count_insertions(const std::string &name, const std::string &assembly, short trim_length, const std::string &file) const
+void screen_service::transcript_selection_changed(const std::string &name)
 {
-	return ScreenData::count_insertions(m_screen_data_dir / name / assembly / std::to_string(trim_length) / file);
-}
+	std::shared_ptr<const std::vector<Transcript>> selection;
 
-std::unique_ptr<ScreenData> screen_service::create_screen(const screen_info &screen)
-{
-	auto screenDir = m_screen_data_dir / screen.name;
+	if (fs::exists(m_transcripts_dir / (name + ".tsv")))
+	{
+		try
+		{
+			selection = compile_transcript_selection(name);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "Could not load transcript selection " << name << ": " << e.what() << std::endl;
+		}
+	}
 
-	std::unique_ptr<ScreenData> data;
+	{
+		std::unique_lock lock(m_transcripts_mutex);
+
+		if (selection)
+			m_transcript_selections[name] = selection;
+		else
+			m_transcript_selections.erase(name);
+	}
+
+	// Drop the caches built from the previous version, both in memory and
+	// the cache files written for each screen, those live in a directory
+	// called <assembly>-<selection>
+	// the normalised control counts of the SL caches kept are still used
+	std::set<uint64_t> keep;
 
-	switch (screen.type)
 	{
-		case ScreenType::IntracellularPhenotype:
+		std::unique_lock lock(m_mutex);
+
+		auto uses_selection = [name](std::shared_ptr<screen_data_cache> i)
 		{
-			data = std::make_unique<IPScreenData>(screenDir, screen);
-			break;
-		}
+			return i->get_transcript_selection() == name;
+		};
 
-		case ScreenType::IntracellularPhenotypeActivation:
+		m_ip_data_cache.erase(std::remove_if(m_ip_data_cache.begin(), m_ip_data_cache.end(), uses_selection), m_ip_data_cache.end());
+		m_sl_data_cache.erase(std::remove_if(m_sl_data_cache.begin(), m_sl_data_cache.end(), uses_selection), m_sl_data_cache.end());
+
+		// builds in flight still serve the requests waiting for them, but
+		// their result is not kept
+		for (auto &[key, build] : m_ip_builds)
 		{
-			data = std::make_unique<PAScreenData>(screenDir, screen);
-			break;
+			if (build.transcript_selection == name)
+				build.discard = true;
 		}
 
-		case ScreenType::SyntheticLethal:
+		for (auto &[key, build] : m_sl_builds)
 		{
-			data = std::make_unique<SLScreenData>(screenDir, screen);
-			break;
+			if (build.transcript_selection == name)
+				build.discard = true;
 		}
 
-		case ScreenType::Unspecified:
-			throw std::runtime_error("Unknown screen type");
-			break;
+		for (auto &cache : m_sl_data_cache)
+			keep.insert(cache->get_transcripts_fingerprint());
 	}
 
-	return data;
-}
-
-void screen_service::update_screen(const std::string &name, const screen_info &screen)
-{
-	ScreenData::saveManifest(screen, m_screen_data_dir / name);
-}
-
-void screen_service::delete_screen(const std::string &name)
-{
-	fs::remove_all(m_screen_data_dir / name);
-}
-
-void screen_service::refresh_manifest(const std::string &name)
-{
-	auto d = m_screen_data_dir / name;
-	auto info = ScreenData::loadManifest(d);
-	ScreenData::refreshManifest(info, d);
-}
+	// The files are removed without holding the mutex, requests should not
+	// wait for this. Files written in the mean time by new builds are
+	// validated with their fingerprints, removing them costs a rebuild only.
+	std::vector<fs::path> stale;
 
-void screen_service::refresh_manifest_all()
-{
-	for (auto si : fs::directory_iterator(m_screen_data_dir))
+	std::error_code ec;
+	for (auto si : fs::directory_iterator(m_screen_data_dir, ec))
 	{
 		if (not si.is_directory())
 			continue;
 
-		std::error_code ec;
-		if (not fs::exists(si.path() / "manifest.json", ec))
-			continue;
+		for (auto ai : fs::directory_iterator(si.path(), ec))
+		{
+			if (not ai.is_directory())
+				continue;
+
+			auto dir = ai.path().filename().string();
+			auto sep = dir.find('-');
+
+			if (sep != std::string::npos)
+			{
+				if (dir.substr(sep + 1) == name)
+					stale.push_back(ai.path());
+				continue;
+			}
+
+			// an <assembly> directory, the normalised counts of a control
+			// screen are keyed by transcripts fingerprint, not by selection
+			for (auto ti : fs::directory_iterator(ai.path(), ec))
+			{
+				if (not ti.is_directory())
+					continue;
+
+				for (auto &f : SLScreenData::findNormalizedInsertionFiles(ti.path(), keep))
+					stale.push_back(f);
+			}
+		}
+	}
 
+	// and the matrix files, these would otherwise be loaded at the next
+	// start only to find the transcripts do not match
+	for (auto &m : scan_matrix_files(m_screen_data_dir / ".caches"))
+	{
 		try
 		{
-			refresh_manifest(si.path().filename().string());
+			if (cache_settings::parse(m.settings).transcript_selection == name)
+				stale.push_back(m.file);
 		}
-		catch (const std::exception &e)
+		catch (const std::exception &ex)
 		{
-			std::cerr << "Could not load screen: " << si.path().filename() << ": " << e.what() << std::endl;
+			std::cerr << "Could not read cache matrix " << m.file << ": " << ex.what() << std::endl;
 		}
 	}
+
+	for (auto &path : stale)
+	{
+		fs::remove_all(path, ec);
+		if (ec)
+			std::cerr << "Could not remove cached data in " << path << ": " << ec.message() << std::endl;
+	}
 }
 
-std::shared_ptr<ip_screen_data_cache> screen_service::get_screen_data(const ScreenType type, const std::string &assembly, short trim_length,
-	const std::string &transcript_selection, Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd, Direction direction)
+void screen_service::watch_directories()
 {
-	std::unique_lock lock(m_mutex);
-
-	auto i = std::find_if(m_ip_data_cache.begin(), m_ip_data_cache.end(),
-		std::bind(&ip_screen_data_cache::is_for, std::placeholders::_1, type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, direction));
-
-	std::shared_ptr<ip_screen_data_cache> result;
+	alignas(inotify_event) char buffer[4096];
 
-	if (i != m_ip_data_cache.end())
+	for (;;)
 	{
-		if ((*i)->is_up_to_date())
-			result = *i;
-		else
-			m_ip_data_cache.erase(i);
-	}
+		pollfd fds[2] = {
+			{ m_watch_fd, POLLIN, 0 },
+			{ m_stop_fd, POLLIN, 0 }
+		};
 
-	if (not result)
-	{
-		result = std::make_shared<ip_screen_data_cache>(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd, direction);
-		m_ip_data_cache.emplace_back(result);
-	}
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "Error watching directories: " << strerror(errno) << std::endl;
+			break;
+		}
 
-	return result;
-}
+		if (fds[1].revents)
+			break;
 
-std::shared_ptr<sl_screen_data_cache> screen_service::get_screen_data(const std::string &assembly, short trim_length,
-	const std::string &transcript_selection, Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd)
-{
-	std::unique_lock lock(m_mutex);
+		auto r = read(m_watch_fd, buffer, sizeof(buffer));
+		if (r <= 0)
+			continue;
 
-	auto i = std::find_if(m_sl_data_cache.begin(), m_sl_data_cache.end(),
-		std::bind(&sl_screen_data_cache::is_for, std::placeholders::_1, ScreenType::SyntheticLethal, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd));
+		std::set<std::string> changed, screens, new_screens;
 
-	std::shared_ptr<sl_screen_data_cache> result;
+		for (char *p = buffer; p < buffer + r;)
+		{
+			auto event = reinterpret_cast<const inotify_event *>(p);
+			p += sizeof(inotify_event) + event->len;
 
-	if (i != m_sl_data_cache.end())
-	{
-		if ((*i)->is_up_to_date())
-			result = *i;
-		else
-			m_sl_data_cache.erase(i);
-	}
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				// events were lost, start over
+				load_registry();
+				continue;
+			}
 
-	if (not result)
-	{
-		result = std::make_shared<sl_screen_data_cache>(assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd);
-		m_sl_data_cache.emplace_back(result);
-	}
+			if (event->mask & IN_IGNORED)
+			{
+				// the watch was removed along with its screen directory
+				std::unique_lock lock(m_registry_mutex);
+				m_screen_watches.erase(event->wd);
+				continue;
+			}
 
-	return result;
-}
+			if (event->len == 0)
+				continue;
 
-void screen_service::screen_mapped(const std::unique_ptr<ScreenData> &screen)
-{
-	std::unique_lock lock(m_mutex);
+			fs::path file(event->name);
 
-	m_ip_data_cache.erase(
-		std::remove_if(m_ip_data_cache.begin(), m_ip_data_cache.end(),
-			[name = screen->name()](std::shared_ptr<screen_data_cache> i)
+			if (event->wd == m_transcripts_wd)
+			{
+				if (file.extension() == ".tsv")
+					changed.insert(file.stem().string());
+			}
+			else if (event->wd == m_screens_wd)
 			{
-				return i->contains_data_for_screen(name);
-			}),
-		m_ip_data_cache.end());
+				// a screen directory was added or removed
+				if (file.string().front() == '.')
+					continue;
 
-	m_sl_data_cache.erase(
-		std::remove_if(m_sl_data_cache.begin(), m_sl_data_cache.end(),
-			[name = screen->name()](std::shared_ptr<screen_data_cache> i)
+				if (event->mask & (IN_CREATE | IN_MOVED_TO))
+					new_screens.insert(file.string());
+				screens.insert(file.string());
+			}
+			else if (file == "manifest.json")
 			{
-				return i->contains_data_for_screen(name);
-			}),
-		m_sl_data_cache.end());
-}
+				std::unique_lock lock(m_registry_mutex);
+				auto i = m_screen_watches.find(event->wd);
+				if (i != m_screen_watches.end())
+					screens.insert(i->second);
+			}
+		}
 
-std::vector<std::string> screen_service::get_all_transcripts() const
-{
-	std::vector<std::string> result;
-	if (fs::is_directory(m_transcripts_dir))
-	{
-		for (fs::directory_iterator di(m_transcripts_dir); di != fs::directory_iterator(); ++di)
-			result.push_back(di->path().filename().stem().string());
+		for (auto &name : new_screens)
+			watch_screen_dir(name);
+
+		for (auto &name : screens)
+		{
+			if (VERBOSE)
+				std::cerr << "Screen " << name << " changed" << std::endl;
+
+			reload_screen(name);
+		}
+
+		for (auto &name : changed)
+		{
+			if (VERBOSE)
+				std::cerr << "Transcript selection " << name << " changed" << std::endl;
+
+			try
+			{
+				transcript_selection_changed(name);
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << e.what() << std::endl;
+			}
+		}
 	}
-	return result;
 }
 
 // --------------------------------------------------------------------
@@ -1652,6 +3737,81 @@ screen_html_controller::screen_html_controller()
 	mount("edit-screen", &screen_html_controller::handle_edit_screen_user);
 
 	mount("screen-table", &screen_html_controller::handle_screen_table);
+
+	mount("admin/caches", &screen_html_controller::handle_admin_caches);
+}
+
+health_controller::health_controller()
+	: zeep::http::html_controller("/")
+{
+	mount("health", &health_controller::handle_health);
+}
+
+void health_controller::handle_health(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply)
+{
+	bool ready = screen_service::instance().is_ready();
+
+	zeep::json::element status;
+	status["status"] = ready ? "ready" : "warming-up";
+	status["ready"] = ready;
+
+	reply.set_content(status);
+	if (not ready)
+		reply.set_status(zeep::http::service_unavailable);
+}
+
+void screen_html_controller::handle_admin_caches(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply)
+{
+	zeep::http::scope sub(scope);
+
+	auto &service = screen_service::instance();
+	auto info = service.get_cache_info();
+
+	auto to_mb = [](size_t bytes)
+	{
+		std::ostringstream s;
+		s << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024);
+		return s.str();
+	};
+
+	size_t total = 0;
+
+	zeep::json::element caches;
+	for (auto &ci : info)
+	{
+		zeep::json::element cache;
+		to_element(cache, ci);
+		cache["memory_mb"] = to_mb(ci.memory);
+		caches.push_back(cache);
+
+		total += ci.memory;
+	}
+
+	sub.put("caches", caches);
+
+	auto [indexCount, indexMemory] = service.get_insertion_index_usage();
+	sub.put("index_count", indexCount);
+	sub.put("index_memory", to_mb(indexMemory));
+
+	sub.put("total", to_mb(total + indexMemory));
+
+	auto budget = service.get_cache_memory_budget();
+	sub.put("budget", budget ? to_mb(budget) + " MB" : "none");
+
+	auto fisherStats = FisherCache::instance().get_stats();
+
+	std::ostringstream hitRate;
+	hitRate << std::fixed << std::setprecision(1) << 100 * fisherStats.hit_rate();
+
+	zeep::json::element fisher;
+	fisher["hits"] = fisherStats.hits;
+	fisher["misses"] = fisherStats.misses;
+	fisher["hit_rate"] = hitRate.str();
+	fisher["size"] = fisherStats.size;
+	fisher["capacity"] = fisherStats.capacity;
+	sub.put("fisher", fisher);
+
+	get_template_processor().create_reply_from_template("admin-caches.html", sub, reply);
 }
 
 void screen_html_controller::handle_screen_user(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply)
@@ -31,10 +31,87 @@
 #include <zeep/http/security.hpp>
 #include <zeep/nvp.hpp>
 
+#include <chrono>
+#include <future>
+#include <tuple>
+
 #include "screen-data.hpp"
+#include "utils.hpp"
+
+// --------------------------------------------------------------------
+
+// Information on a screen data cache, for the admin page
+
+struct cache_info
+{
+	ScreenType type;
+	std::string assembly;
+	short trim_length;
+	std::string transcript_selection;
+	Mode mode;
+	bool cut_overlap;
+	std::string gene_start;
+	std::string gene_end;
+	std::optional<Direction> direction;
+	size_t memory;
+	size_t hits;
+	long idle;	// seconds since last use
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long)
+	{
+		ar & zeep::make_nvp("type", type)
+		   & zeep::make_nvp("assembly", assembly)
+		   & zeep::make_nvp("trim_length", trim_length)
+		   & zeep::make_nvp("transcript_selection", transcript_selection)
+		   & zeep::make_nvp("mode", mode)
+		   & zeep::make_nvp("cut_overlap", cut_overlap)
+		   & zeep::make_nvp("gene_start", gene_start)
+		   & zeep::make_nvp("gene_end", gene_end)
+		   & zeep::make_nvp("direction", direction)
+		   & zeep::make_nvp("memory", memory)
+		   & zeep::make_nvp("hits", hits)
+		   & zeep::make_nvp("idle", idle);
+	}
+};
+
+// --------------------------------------------------------------------
+
+// A block of memory holding the data of a cache, either zero filled
+// anonymous memory or mapped from a matrix file.
+
+class cache_block
+{
+  public:
+	cache_block() = default;
+	explicit cache_block(size_t size);
+	cache_block(const std::filesystem::path &file, size_t offset, size_t size);
+
+	cache_block(cache_block &&rhs) noexcept;
+	cache_block &operator=(cache_block &&rhs) noexcept;
+
+	cache_block(const cache_block &) = delete;
+	cache_block &operator=(const cache_block &) = delete;
+
+	~cache_block();
+
+	char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	// Prefault mapped files, and ask for transparent huge pages
+	static void set_options(bool populate, bool huge_pages);
+
+  private:
+	char *m_data = nullptr;
+	size_t m_size = 0;
+
+	static bool s_populate, s_huge_pages;
+};
 
 // --------------------------------------------------------------------
 
+struct cache_settings;
+
 class screen_data_cache
 {
   public:
@@ -53,10 +130,66 @@ class screen_data_cache
 
 	bool is_up_to_date() const;
 
+	// A string identifying the settings, caches differing only in
+	// direction share the same key
+	static std::string settings_key(ScreenType type, const std::string &assembly, short trim_length, const std::string &transcript_selection,
+		Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd);
+
+	std::string settings_key() const
+	{
+		return settings_key(m_type, m_assembly, m_trim_length, m_transcript_selection, m_mode, m_cutOverlap, m_geneStart, m_geneEnd);
+	}
+
+	bool has_same_settings(const screen_data_cache &other) const
+	{
+		return is_for(other.m_type, other.m_assembly, other.m_trim_length, other.m_transcript_selection,
+			other.m_mode, other.m_cutOverlap, other.m_geneStart, other.m_geneEnd);
+	}
+
+	ScreenType get_type() const { return m_type; }
+	const std::string &get_transcript_selection() const { return m_transcript_selection; }
+
 	virtual std::filesystem::path get_cache_file_path(const std::string &screen_name) const = 0;
 	virtual bool contains_data_for_screen(const std::string &screen) const = 0;
 
+	// The number of bytes taken up by the cached data
+	virtual size_t memory_usage() const = 0;
+
+	virtual cache_info get_info() const;
+
+	// Usage statistics, these are maintained by screen_service while
+	// holding its mutex
+	void record_use()
+	{
+		++m_hits;
+		m_last_used = std::chrono::steady_clock::now();
+	}
+
+	std::chrono::steady_clock::time_point get_last_used() const { return m_last_used; }
+
+	// Set when screens were added that are not in the matrix file. Writing
+	// the matrix is left to screen_service, which batches these writes.
+	// Both are done while holding its mutex.
+	bool is_matrix_dirty() const { return m_matrix_dirty; }
+	void clear_matrix_dirty() { m_matrix_dirty = false; }
+
+	virtual void write_matrix() const = 0;
+
+	uint64_t get_transcripts_fingerprint() const { return m_transcript_set->fingerprint; }
+
+	// The fingerprint of the transcripts a cache for \a settings would
+	// use now, to check matrix files against without building the cache
+	static uint64_t get_transcripts_fingerprint(const cache_settings &settings);
+
   protected:
+	// The matrix file holds all the data of a cache in one file: a header,
+	// the list of screens and the data block which is mapped into memory
+	// as is. Only used when the screen list matches exactly.
+	virtual std::filesystem::path get_matrix_file_path() const = 0;
+
+	std::optional<cache_block> load_matrix(size_t data_size);
+	void write_matrix_file(const cache_block &block) const;
+
 	struct cached_screen
 	{
 		std::string name;
@@ -65,8 +198,20 @@ class screen_data_cache
 		uint8_t file_count = 0;
 		uint32_t data_offset = 0;
 		uint32_t replicate_offset = 0;
+		uint64_t input_fingerprint = 0;
 	};
 
+	// Set the fingerprint of the insertion files for each screen, taken
+	// from \a base for screens not in \a changed. The \a salt is mixed in,
+	// for data that depends on more than the screen itself.
+	void set_input_fingerprints(const screen_data_cache *base, const std::set<std::string> &changed, uint64_t salt = 0);
+
+	// The per-screen cache files start with a header holding the fingerprints
+	// of the transcripts and the input and the version of the algorithm.
+	// Reading fails if any of these does not match.
+	bool read_cache_file(const cached_screen &screen, std::initializer_list<std::pair<void *, size_t>> parts) const;
+	void write_cache_file(const cached_screen &screen, std::initializer_list<std::pair<const void *, size_t>> parts) const;
+
 	ScreenType m_type;
 	std::string m_assembly;
 	short m_trim_length;
@@ -75,8 +220,24 @@ class screen_data_cache
 	bool m_cutOverlap;
 	std::string m_geneStart;
 	std::string m_geneEnd;
-	std::vector<Transcript> m_transcripts;
+	// The transcripts are never modified once loaded, caches that only
+	// differ in direction and the caches replacing them share them.
+	struct transcript_set
+	{
+		std::vector<Transcript> transcripts;
+		TranscriptTable table;	// columnar copy of transcripts for the hot loops
+		uint64_t fingerprint = 0;
+	};
+
+	static std::shared_ptr<const transcript_set> make_transcript_set(std::vector<Transcript> &&transcripts);
+
+	std::shared_ptr<const transcript_set> m_transcript_set;
 	std::vector<cached_screen> m_screens;
+
+	bool m_matrix_dirty = false;
+
+	size_t m_hits = 0;
+	std::chrono::steady_clock::time_point m_last_used = std::chrono::steady_clock::now();
 };
 
 struct ip_data_point
@@ -175,9 +336,20 @@ struct cluster
 class ip_screen_data_cache : public screen_data_cache
 {
   public:
-	ip_screen_data_cache(ScreenType type, const std::string &assembly, short trim_length, const std::string &transcript_selection,
-		Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd,
-		Direction direction);
+	// Create the caches for each of \a directions. The insertions of each
+	// screen are read and counted only once, only the statistics differ.
+	static std::vector<std::shared_ptr<ip_screen_data_cache>> create(ScreenType type, const std::string &assembly, short trim_length,
+		const std::string &transcript_selection, Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd,
+		const std::vector<Direction> &directions);
+
+	// Create copies of \a base, caches that differ in direction only,
+	// recalculating only the screens in \a changed and picking up screens
+	// that were added or removed since.
+	static std::vector<std::shared_ptr<ip_screen_data_cache>> update(const std::vector<std::shared_ptr<ip_screen_data_cache>> &base,
+		const std::set<std::string> &changed);
+
+	ip_screen_data_cache(const ip_screen_data_cache &) = delete;
+	ip_screen_data_cache &operator=(const ip_screen_data_cache &) = delete;
 
 	~ip_screen_data_cache();
 
@@ -188,6 +360,15 @@ class ip_screen_data_cache : public screen_data_cache
 		return screen_data_cache::is_for(type, assembly, trim_length, transcript_selection, mode, cutOverlap, geneStart, geneEnd) and m_direction == direction;
 	}
 
+	Direction get_direction() const { return m_direction; }
+
+	cache_info get_info() const override
+	{
+		auto result = screen_data_cache::get_info();
+		result.direction = m_direction;
+		return result;
+	}
+
 	bool contains_data_for_screen(const std::string &screen) const override
 	{
 		auto si = std::find_if(m_screens.begin(), m_screens.end(), [screen](auto &si)
@@ -204,6 +385,12 @@ class ip_screen_data_cache : public screen_data_cache
 
 	virtual std::filesystem::path get_cache_file_path(const std::string &screen_name) const override;
 
+	size_t memory_usage() const override
+	{
+		return m_block.size() +
+		       m_gene_data.size() * sizeof(gene_data_point);
+	}
+
   private:
 	struct data_point
 	{
@@ -216,8 +403,37 @@ class ip_screen_data_cache : public screen_data_cache
 
 	// size_t index(size_t screen_nr, size_t transcript) const;
 
+	ip_screen_data_cache(ScreenType type, const std::string &assembly, short trim_length, const std::string &transcript_selection,
+		Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd,
+		Direction direction);
+
+	ip_screen_data_cache(const ip_screen_data_cache &settings, Direction direction);
+
+	static void fill(const std::vector<ip_screen_data_cache *> &caches, const std::vector<const ip_screen_data_cache *> &bases,
+		const std::set<std::string> &changed);
+
+	// Gene-major copy of the fields used by queries that look at a gene
+	// in all screens, indexed as gene * screen count + screen.
+	struct gene_data_point
+	{
+		float fcpv;
+		float mi;
+		uint32_t insertions;
+	};
+
+	void transpose();
+
+	std::filesystem::path get_matrix_file_path() const override;
+
+	void write_matrix() const override
+	{
+		write_matrix_file(m_block);
+	}
+
 	Direction m_direction;
+	cache_block m_block;
 	data_point *m_data;
+	std::vector<gene_data_point> m_gene_data;
 };
 
 // --------------------------------------------------------------------
@@ -290,8 +506,18 @@ class sl_screen_data_cache : public screen_data_cache
 	sl_screen_data_cache(const std::string &assembly, short trim_length, const std::string &transcript_selection,
 		Mode mode, bool cutOverlap, const std::string &geneStart, const std::string &geneEnd);
 
+	// Create a copy of \a base, recalculating only the screens in \a changed
+	// and picking up screens that were added or removed since.
+	sl_screen_data_cache(const sl_screen_data_cache &base, const std::set<std::string> &changed);
+
+	sl_screen_data_cache(const sl_screen_data_cache &) = delete;
+	sl_screen_data_cache &operator=(const sl_screen_data_cache &) = delete;
+
 	~sl_screen_data_cache();
 
+	// SL caches work on the transcripts without exons, ordered by position
+	static void prepare_transcripts(std::vector<Transcript> &transcripts);
+
 	bool contains_data_for_screen(const std::string &screen) const override
 	{
 		auto si = std::find_if(m_screens.begin(), m_screens.end(), [screen](auto &si)
@@ -308,6 +534,13 @@ class sl_screen_data_cache : public screen_data_cache
 
 	virtual std::filesystem::path get_cache_file_path(const std::string &screen_name) const override;
 
+	size_t memory_usage() const override
+	{
+		return m_block.size() +
+		       m_gene_odds_ratio.size() * sizeof(float) +
+		       m_gene_replicate_data.size() * sizeof(gene_replicate);
+	}
+
   private:
 
 	struct data_point
@@ -323,8 +556,58 @@ class sl_screen_data_cache : public screen_data_cache
 		float pv[4];
 	};
 
+	// Gene-major copies of the fields used by find_gene, indexed as
+	// gene * screen count + screen and gene * replicate count + replicate.
+	struct gene_replicate
+	{
+		uint32_t sense, antisense;
+	};
+
+	// returns true if screens were added that are not in the matrix file
+	bool fill(const sl_screen_data_cache *base, const std::set<std::string> &changed);
+	void transpose();
+	void report_memory_usage() const;
+
+	std::filesystem::path get_matrix_file_path() const override;
+
+	void write_matrix() const override
+	{
+		write_matrix_file(m_block);
+	}
+
+	// The data points of all screens followed by the replicates of all screens,
+	// N entries per screen and per replicate respectively. The replicates
+	// of a screen are stored consecutively, in the same order as in its
+	// cache file. Both are stored in a single block.
+	cache_block m_block;
 	data_point *m_data;
 	data_point_replicate *m_replicate_data;
+	std::vector<float> m_gene_odds_ratio;
+	std::vector<gene_replicate> m_gene_replicate_data;
+};
+
+// --------------------------------------------------------------------
+
+// Settings for a cache to build right after start up. Written as
+// type:assembly:transcripts:mode:cut|no-cut:gene-start:gene-end
+
+struct cache_settings
+{
+	ScreenType type;
+	std::string assembly;
+	std::string transcript_selection;
+	Mode mode;
+	bool cut_overlap;
+	std::string gene_start;
+	std::string gene_end;
+
+	static cache_settings parse(const std::string &s);
+
+	bool operator==(const cache_settings &rhs) const
+	{
+		return type == rhs.type and assembly == rhs.assembly and transcript_selection == rhs.transcript_selection and
+		       mode == rhs.mode and cut_overlap == rhs.cut_overlap and gene_start == rhs.gene_start and gene_end == rhs.gene_end;
+	}
 };
 
 // --------------------------------------------------------------------
@@ -338,6 +621,8 @@ class screen_service
 
 	static screen_service &instance();
 
+	~screen_service();
+
 	const std::filesystem::path &get_screen_data_dir() const { return m_screen_data_dir; }
 	const std::filesystem::path &get_transcripts_dir() const { return m_transcripts_dir; }
 
@@ -391,16 +676,141 @@ class screen_service
 
 	void screen_mapped(const std::unique_ptr<ScreenData> &screen);
 
+	// The memory to use at most for screen data caches, the least recently
+	// used caches are dropped when it is exceeded. Zero means no limit.
+	static void set_cache_memory_budget(size_t bytes);
+
+	std::vector<cache_info> get_cache_info();
+	size_t get_cache_memory_budget() const { return s_cache_memory_budget; }
+	size_t get_cache_memory() const { return m_cache_memory; }
+
+	// The memory to use at most for insertion indices. These get what the
+	// caches leave of the memory budget, zero means no other limit.
+	static void set_insertion_index_memory(size_t bytes);
+
+	// The number of insertion indices kept and the memory they take up
+	std::tuple<size_t, size_t> get_insertion_index_usage();
+
+	// The memory to use at most for raw insertions while building SL
+	// caches, limited further by what is left of the memory budget
+	static void set_sl_build_memory(size_t bytes);
+	size_t get_sl_build_memory();
+
+	// The caches to build in the background when the service starts. The
+	// service is ready when these are done, the caches that still have a
+	// valid matrix file are loaded after that as long as memory permits.
+	static void set_warm_up(const std::vector<cache_settings> &settings);
+
+	bool is_ready() const { return m_ready; }
+	void set_ready() { m_ready = true; }
+
+	// Write the matrix files of the caches that have screens added since
+	// their matrix was last written. Called from a job, scheduled after
+	// builds and updates, so a series of updates results in one write.
+	void write_matrices();
+
 	// configurable transcripts
 	std::vector<std::string> get_all_transcripts() const;
 
+	// The parsed contents of a custom transcript selection. Selections are
+	// compiled once and recompiled only when the watcher sees the file change.
+	std::shared_ptr<const std::vector<Transcript>> load_transcript_selection(const std::string &name);
+
+	// Indices on the low and high insertions of IP screens. These are kept
+	// in memory, up to a limit, so that analysing a screen for another gene
+	// window does not require reading all insertions again.
+	using ip_insertion_index = std::array<InsertionIndex, 2>;
+
+	std::shared_ptr<const ip_insertion_index> find_insertion_index(const std::string &screen, const std::string &assembly, short trim_length);
+	void store_insertion_index(const std::string &screen, const std::string &assembly, short trim_length,
+		std::shared_ptr<const ip_insertion_index> index);
+
   private:
 	screen_service(const std::string &screen_data_dir, const std::string &transcripts_dir);
 
+	std::shared_ptr<const std::vector<Transcript>> compile_transcript_selection(const std::string &name) const;
+	void transcript_selection_changed(const std::string &name);
+	void watch_directories();
+
+	// The registry of screens, kept in memory and updated when a manifest
+	// changes. Readers get a snapshot that is never modified.
+	using screen_registry = std::map<std::string, screen_info>;
+
+	std::shared_ptr<const screen_registry> get_registry() const;
+	std::optional<screen_info> find_screen(const std::string &name) const;
+	void load_registry();
+	void watch_screen_dir(const std::string &name);
+	void reload_screen(const std::string &name);
+
+	// A cache being built or updated. Requests for the same settings wait
+	// for this build instead of starting their own.
+	template <typename Cache>
+	struct cache_build
+	{
+		using cache_group = std::vector<std::shared_ptr<Cache>>;
+
+		std::shared_future<cache_group> result;
+		ScreenType type;
+		std::string transcript_selection;
+		std::set<std::string> changed;	// screens mapped while building
+		bool discard = false;			// transcript selection changed while building
+
+		// raised to the priority of the requests waiting for the result
+		std::shared_ptr<priority_boost> boost = std::make_shared<priority_boost>();
+	};
+
+	void evict_caches();
+
+	// m_mutex should be held
+	void schedule_matrix_writes();
+
+	// m_index_mutex should be held
+	size_t get_insertion_index_limit() const;
+	void trim_insertion_indices(size_t keep);
+
+	template <typename Cache, typename Build>
+	std::vector<std::shared_ptr<Cache>> run_build(const std::string &key, std::promise<std::vector<std::shared_ptr<Cache>>> &promise,
+		std::map<std::string, cache_build<Cache>> &builds, std::list<std::shared_ptr<Cache>> &caches,
+		const std::vector<std::shared_ptr<Cache>> &replaced, Build &&build);
+
 	std::filesystem::path m_screen_data_dir, m_transcripts_dir;
+
+	// m_mutex protects the lists of caches and the builds in flight, it is
+	// never held while building a cache
 	std::mutex m_mutex;
 	std::list<std::shared_ptr<ip_screen_data_cache>> m_ip_data_cache;
 	std::list<std::shared_ptr<sl_screen_data_cache>> m_sl_data_cache;
+	std::map<std::string, cache_build<ip_screen_data_cache>> m_ip_builds;
+	std::map<std::string, cache_build<sl_screen_data_cache>> m_sl_builds;
+
+	static size_t s_cache_memory_budget, s_insertion_index_memory, s_sl_build_memory;
+	std::atomic<size_t> m_cache_memory = 0;	// as of the last call to evict_caches
+	static std::vector<cache_settings> s_warm_up;
+	std::atomic<bool> m_ready = false;
+	std::atomic<bool> m_matrix_writes_scheduled = false;
+
+	mutable std::mutex m_transcripts_mutex;
+	std::map<std::string, std::shared_ptr<const std::vector<Transcript>>> m_transcript_selections;
+
+	mutable std::mutex m_registry_mutex;
+	std::shared_ptr<const screen_registry> m_registry;
+	std::map<int, std::string> m_screen_watches;	// watch descriptor to screen name
+
+	int m_watch_fd = -1, m_stop_fd = -1;
+	int m_transcripts_wd = -1, m_screens_wd = -1;
+	std::thread m_watcher;
+
+	struct insertion_index_entry
+	{
+		std::string screen, assembly;
+		short trim_length;
+		std::shared_ptr<const ip_insertion_index> index;
+		size_t size;
+	};
+
+	std::mutex m_index_mutex;
+	std::list<insertion_index_entry> m_insertion_indices; // most recently used first
+	size_t m_insertion_index_memory = 0;
 
 	static std::unique_ptr<screen_service> s_instance;
 };
@@ -422,6 +832,21 @@ class screen_html_controller : public zeep::http::html_controller
 	void handle_create_screen_user(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply);
 	void handle_edit_screen_user(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply);
 	void handle_screen_table(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply);
+
+	void handle_admin_caches(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply);
+};
+
+// --------------------------------------------------------------------
+
+// Reports whether the service is ready to handle requests, meant for
+// load balancers. Answers 503 until the caches are warmed up.
+
+class health_controller : public zeep::http::html_controller
+{
+  public:
+	health_controller();
+
+	void handle_health(const zeep::http::request &request, const zeep::http::scope &scope, zeep::http::reply &reply);
 };
 
 // --------------------------------------------------------------------
@@ -45,51 +45,341 @@ const auto kProcessorCount = std::thread::hardware_concurrency();
 
 // --------------------------------------------------------------------
 
-void parallel_for(size_t N, std::function<void(size_t)>&& f)
+// index of the pool worker running in this thread, if any
+thread_local size_t tl_worker_ix = ~0UL;
+
+// priority of the work done by this thread
+thread_local task_priority tl_priority = task_priority::interactive;
+thread_local std::shared_ptr<priority_boost> tl_boost;
+
+void priority_boost::raise(task_priority priority)
 {
+	std::unique_lock lock(m_mutex);
 
-#if DEBUG
-	if (getenv("NO_PARALLEL"))
+	if (priority >= m_priority)
+		return;
+
+	m_priority = priority;
+
+	for (auto &l : m_listeners)
+		l(priority);
+}
+
+std::list<priority_boost::listener>::iterator priority_boost::add_listener(listener &&l)
+{
+	std::unique_lock lock(m_mutex);
+	return m_listeners.insert(m_listeners.end(), std::move(l));
+}
+
+void priority_boost::remove_listener(std::list<listener>::iterator l)
+{
+	std::unique_lock lock(m_mutex);
+	m_listeners.erase(l);
+}
+
+scoped_priority::scoped_priority(task_priority priority)
+	: m_saved(tl_priority)
+	, m_saved_boost(tl_boost)
+{
+	tl_priority = priority;
+}
+
+scoped_priority::scoped_priority(std::shared_ptr<priority_boost> boost)
+	: m_saved(tl_priority)
+	, m_saved_boost(tl_boost)
+{
+	tl_boost = boost;
+}
+
+scoped_priority::~scoped_priority()
+{
+	tl_priority = m_saved;
+	tl_boost = m_saved_boost;
+}
+
+task_priority current_priority()
+{
+	if (tl_boost)
+		return std::min(tl_priority, tl_boost->get());
+	return tl_priority;
+}
+
+// --------------------------------------------------------------------
+
+thread_pool &thread_pool::instance()
+{
+	static thread_pool s_instance(kProcessorCount > 0 ? kProcessorCount : 1);
+	return s_instance;
+}
+
+thread_pool::thread_pool(size_t thread_count)
+{
+	for (size_t i = 0; i < thread_count; ++i)
+		m_queues.emplace_back(new task_queue);
+
+	for (size_t i = 0; i < thread_count; ++i)
+		m_workers.emplace_back(&thread_pool::worker, this, i);
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::unique_lock lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_cv.notify_all();
+
+	for (auto &t : m_workers)
+		t.join();
+}
+
+void thread_pool::set_reservations(size_t interactive, size_t batch)
+{
+	size_t available = m_workers.size() - 1;
+
+	interactive = std::min(interactive, available);
+	batch = std::min(batch, available - interactive);
+
+	m_reserved_interactive = interactive;
+	m_reserved_batch = batch;
+
+	// workers may now be allowed to pick up tasks they skipped before
+	{
+		std::unique_lock lock(m_mutex);
+	}
+	m_cv.notify_all();
+}
+
+task_priority thread_pool::lowest_priority_for_worker(size_t ix) const
+{
+	if (ix < m_reserved_interactive)
+		return task_priority::interactive;
+	if (ix < m_reserved_interactive + m_reserved_batch)
+		return task_priority::batch;
+	return task_priority::background;
+}
+
+void thread_pool::push(task &&t, task_priority priority)
+{
+	size_t ix = tl_worker_ix < m_queues.size() ? tl_worker_ix : m_next_queue++ % m_queues.size();
+	size_t p = static_cast<size_t>(priority);
+
+	{
+		std::unique_lock lock(m_queues[ix]->mutex);
+		m_queues[ix]->tasks[p].emplace_back(std::move(t));
+	}
+
+	++m_queued[p];
+}
+
+bool thread_pool::has_work(task_priority lowest) const
+{
+	for (size_t p = 0; p <= static_cast<size_t>(lowest); ++p)
+	{
+		if (m_queued[p] > 0)
+			return true;
+	}
+
+	return false;
+}
+
+bool thread_pool::run_one(task_priority lowest)
+{
+	for (size_t p = 0; p <= static_cast<size_t>(lowest); ++p)
+	{
+		if (m_queued[p] == 0)
+			continue;
+
+		task t;
+
+		// our own queue first, newest task first since that one is most
+		// likely to be nested in what we're doing now
+		if (tl_worker_ix < m_queues.size())
+		{
+			auto &q = *m_queues[tl_worker_ix];
+			std::unique_lock lock(q.mutex);
+			if (not q.tasks[p].empty())
+			{
+				t = std::move(q.tasks[p].back());
+				q.tasks[p].pop_back();
+			}
+		}
+
+		// then steal the oldest task of someone else
+		for (size_t i = 0; not t and i < m_queues.size(); ++i)
+		{
+			auto &q = *m_queues[(tl_worker_ix + 1 + i) % m_queues.size()];
+			std::unique_lock lock(q.mutex);
+			if (not q.tasks[p].empty())
+			{
+				t = std::move(q.tasks[p].front());
+				q.tasks[p].pop_front();
+			}
+		}
+
+		if (not t)
+			continue;
+
+		--m_queued[p];
+
+		scoped_priority priority(static_cast<task_priority>(p));
+		t();
+
+		return true;
+	}
+
+	return false;
+}
+
+void thread_pool::worker(size_t ix)
+{
+	tl_worker_ix = ix;
+
+	for (;;)
+	{
+		if (run_one(lowest_priority_for_worker(ix)))
+			continue;
+
+		std::unique_lock lock(m_mutex);
+		m_cv.wait(lock, [this, ix]
+			{ return m_stop or has_work(lowest_priority_for_worker(ix)); });
+
+		if (m_stop and not has_work(task_priority::background))
+			break;
+	}
+}
+
+void thread_pool::parallel_for(size_t N, const std::function<void(size_t)> &f)
+{
+	if (N == 0)
+		return;
+
+	if (N == 1 or m_workers.size() == 1)
 	{
 		for (size_t i = 0; i < N; ++i)
 			f(i);
 		return;
 	}
-#endif
 
-	std::atomic<size_t> i = 0;
+	struct state
+	{
+		std::atomic<size_t> next = 0;	// the first chunk no one picked up
+		std::atomic<size_t> pending;	// the chunks not done yet
+		std::atomic<bool> failed = false;
+		std::exception_ptr eptr;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+
+	// a few chunks per worker so that stealing can even out the load
+	size_t chunks = std::min(N, 4 * m_workers.size());
+	size_t chunk_size = (N + chunks - 1) / chunks;
+	chunks = (N + chunk_size - 1) / chunk_size;
 
-	std::exception_ptr eptr;
-	std::mutex m;
+	auto s = std::make_shared<state>();
+	s->pending = chunks;
 
-	std::list<std::thread> t;
+	// the chunks inherit the priority and boost of the caller
+	task_priority priority = tl_priority;
+	auto boost = tl_boost;
 
-	for (size_t n = 0; n < kProcessorCount; ++n)
-		t.emplace_back([N, &i, &f, &eptr, &m]()
+	// Run the next chunk, if any. The queued tasks only trigger this, so
+	// a task that comes too late does nothing and f is not used after
+	// this call returns.
+	auto run_next = [s, &f, N, chunks, chunk_size, priority, boost]()
+	{
+		size_t c = s->next++;
+		if (c >= chunks)
+			return false;
+
+		if (not s->failed)
 		{
+			scoped_priority p(priority);
+			scoped_priority b(boost);
+
 			try
 			{
-				for (;;)
-				{
-					auto next = i++;
-					if (next >= N)
-						break;
-				
-					f(next);
-				}
+				for (size_t i = c * chunk_size; i < std::min(N, (c + 1) * chunk_size); ++i)
+					f(i);
 			}
-			catch(const std::exception& e)
+			catch (...)
 			{
-				std::unique_lock lock(m);
-				eptr = std::current_exception();
+				std::unique_lock lock(s->mutex);
+				if (not s->eptr)
+					s->eptr = std::current_exception();
+				s->failed = true;
 			}
-		});
+		}
+
+		if (--s->pending == 0)
+		{
+			std::unique_lock lock(s->mutex);
+			s->cv.notify_all();
+		}
 
-	for (auto& ti: t)
-		ti.join();
+		return true;
+	};
+
+	auto queue = [this, run_next, chunks, s](task_priority p)
+	{
+		for (size_t c = s->next; c < chunks; ++c)
+			push([run_next]()
+				{ run_next(); },
+				p);
+
+		{
+			std::unique_lock lock(m_mutex);
+		}
+		m_cv.notify_all();
+	};
+
+	task_priority effective = current_priority();
+	queue(effective);
+
+	// when someone starts waiting for this work, the chunks left are
+	// queued again at the raised priority
+	std::list<priority_boost::listener>::iterator listener;
+	if (boost)
+	{
+		listener = boost->add_listener([queue, effective](task_priority p)
+			{
+			if (p < effective)
+				queue(p); });
+	}
+
+	// Run the chunks no one picked up yet, then wait for the others. Only
+	// chunks of this call are run here, other work could take longer.
+	while (run_next())
+		;
+
+	{
+		std::unique_lock lock(s->mutex);
+		s->cv.wait(lock, [&s]
+			{ return s->pending == 0; });
+	}
+
+	if (boost)
+		boost->remove_listener(listener);
+
+	if (s->eptr)
+		std::rethrow_exception(s->eptr);
+}
+
+// --------------------------------------------------------------------
+
+void parallel_for(size_t N, std::function<void(size_t)> &&f)
+{
+#if DEBUG
+	if (getenv("NO_PARALLEL"))
+	{
+		for (size_t i = 0; i < N; ++i)
+			f(i);
+		return;
+	}
+#endif
 
-	if (eptr)
-		std::rethrow_exception(eptr);
+	thread_pool::instance().parallel_for(N, f);
 }
 
 // -----------------------------------------------------------------------
@@ -26,13 +26,271 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 // --------------------------------------------------------------------
+// Scheduling classes for work done on the thread_pool. Interactive work,
+// answering HTTP requests, goes first. Batch work like building caches
+// comes next and background jobs like mapping screens last.
+
+enum class task_priority : uint8_t
+{
+	interactive,
+	batch,
+	background
+};
+
+// A priority that can be raised while the work done with it runs, e.g.
+// when a request starts waiting for a cache built by a background job.
+// Work done under a boost runs at the more urgent of its own priority and
+// that of the boost, tasks queued before the raise are moved up as well.
+
+class priority_boost
+{
+  public:
+	task_priority get() const	{ return m_priority; }
+
+	// Raise to at least \a priority
+	void raise(task_priority priority);
+
+  private:
+	friend class thread_pool;
+
+	using listener = std::function<void(task_priority)>;
+
+	std::list<listener>::iterator add_listener(listener &&l);
+	void remove_listener(std::list<listener>::iterator l);
+
+	std::atomic<task_priority> m_priority = task_priority::background;
+	std::mutex m_mutex;
+	std::list<listener> m_listeners;
+};
+
+// Set the priority of the work started by the current thread for as
+// long as this object exists. Tasks run with the priority of the thread
+// that queued them. The second form keeps the priority but puts the work
+// under \a boost.
+
+class scoped_priority
+{
+  public:
+	scoped_priority(task_priority priority);
+	scoped_priority(std::shared_ptr<priority_boost> boost);
+	~scoped_priority();
+
+	scoped_priority(const scoped_priority&) = delete;
+	scoped_priority& operator=(const scoped_priority&) = delete;
+
+  private:
+	task_priority m_saved;
+	std::shared_ptr<priority_boost> m_saved_boost;
+};
+
+// The priority of the work started by the current thread
+task_priority current_priority();
+
+// --------------------------------------------------------------------
+// A process wide pool of worker threads, one per core. Each worker has
+// its own queues of tasks, idle workers steal from the queues of others.
+// A thread waiting for a parallel_for runs the chunks of that call no one
+// picked up yet, so nested use neither blocks workers nor starts new
+// threads. Workers always pick the most urgent task available to them.
+
+class thread_pool
+{
+  public:
+	static thread_pool& instance();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	~thread_pool();
+
+	size_t size() const		{ return m_workers.size(); }
+
+	// Keep workers free for urgent work: the first \a interactive workers
+	// only run interactive tasks, the next \a batch workers do not run
+	// background tasks. At least one worker remains for everything.
+	void set_reservations(size_t interactive, size_t batch);
+
+	// Run f for 0 <= i < N in chunks and wait until all are done. The
+	// first exception thrown by f is rethrown, remaining chunks are skipped.
+	void parallel_for(size_t N, const std::function<void(size_t)>& f);
+
+  private:
+	static constexpr size_t kPriorityCount = 3;
+
+	using task = std::function<void()>;
+
+	struct task_queue
+	{
+		std::mutex mutex;
+		std::deque<task> tasks[kPriorityCount];
+	};
+
+	thread_pool(size_t thread_count);
+
+	void push(task&& t, task_priority priority);
+	bool run_one(task_priority lowest);
+	bool has_work(task_priority lowest) const;
+	task_priority lowest_priority_for_worker(size_t ix) const;
+	void worker(size_t ix);
+
+	std::vector<std::unique_ptr<task_queue>> m_queues;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<size_t> m_queued[kPriorityCount] = {};
+	std::atomic<size_t> m_next_queue = 0;
+	std::atomic<size_t> m_reserved_interactive = 0, m_reserved_batch = 0;
+	bool m_stop = false;
+};
+
+// --------------------------------------------------------------------
+// Run f for 0 <= i < N using all cores, shorthand for the thread_pool.
 
 void parallel_for(size_t N, std::function<void(size_t)>&& f);
 
+// --------------------------------------------------------------------
+// Limit the number of threads running a section of code at the same time
+
+class semaphore
+{
+  public:
+	semaphore(size_t count)
+		: m_count(count) {}
+
+	semaphore(const semaphore&) = delete;
+	semaphore& operator=(const semaphore&) = delete;
+
+	void acquire()
+	{
+		std::unique_lock lock(m_mutex);
+		m_cv.wait(lock, [this] { return m_count > 0; });
+		--m_count;
+	}
+
+	void release()
+	{
+		std::unique_lock lock(m_mutex);
+		++m_count;
+		m_cv.notify_one();
+	}
+
+  private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	size_t m_count;
+};
+
+class semaphore_guard
+{
+  public:
+	semaphore_guard(semaphore& s)
+		: m_semaphore(s)
+	{
+		m_semaphore.acquire();
+	}
+
+	~semaphore_guard()
+	{
+		m_semaphore.release();
+	}
+
+  private:
+	semaphore& m_semaphore;
+};
+
+// --------------------------------------------------------------------
+// A bounded memo that is safe to use from parallel_for workers. The
+// entries are spread over shards, each with its own lock. A full shard
+// is simply emptied, values that recur often will quickly return.
+
+struct memo_stats
+{
+	uint64_t hits, misses;
+	size_t size, capacity;
+
+	double hit_rate() const { return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0; }
+};
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class sharded_memo
+{
+  public:
+	sharded_memo() = default;
+	sharded_memo(const sharded_memo&) = delete;
+	sharded_memo& operator=(const sharded_memo&) = delete;
+
+	// Return the value for \a key, calling \a calculate if it is not known.
+	// The calculation is done without holding a lock.
+	template <typename F>
+	Value operator()(const Key& key, F&& calculate)
+	{
+		auto& s = m_shards[((Hash()(key) * 0x9e3779b97f4a7c15ULL) >> 32) % kShardCount];
+
+		{
+			std::unique_lock lock(s.mutex);
+
+			auto i = s.values.find(key);
+			if (i != s.values.end())
+			{
+				++m_hits;
+				return i->second;
+			}
+		}
+
+		++m_misses;
+
+		Value result = calculate();
+
+		std::unique_lock lock(s.mutex);
+
+		if (s.values.size() >= kShardCapacity)
+			s.values.clear();
+
+		s.values.emplace(key, result);
+
+		return result;
+	}
+
+	memo_stats get_stats() const
+	{
+		size_t size = 0;
+		for (auto& s : m_shards)
+		{
+			std::unique_lock lock(s.mutex);
+			size += s.values.size();
+		}
+
+		return { m_hits, m_misses, size, kShardCount * kShardCapacity };
+	}
+
+  private:
+	static constexpr size_t kShardCount = 64, kShardCapacity = 4096;
+
+	struct shard
+	{
+		mutable std::mutex mutex;
+		std::unordered_map<Key, Value, Hash> values;
+	};
+
+	shard m_shards[kShardCount];
+	std::atomic<uint64_t> m_hits{ 0 }, m_misses{ 0 };
+};
+
 // --------------------------------------------------------------------
 
 int get_terminal_width();